@@ -0,0 +1,948 @@
+#include "chip8.h"
+#include "disasm.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ *  chip8-asm: assembles source text into a rom for load_rom().
+ *
+ *  Instructions use the mnemonics chip8-dis prints, matched against the
+ *  format table in disasm.c in order, so both tools always agree.
+ *  Operands are expressions of numbers (decimal, 0x hex, 0b binary), labels
+ *  and constants with + - * / % and parentheses.
+ *
+ *    label:              defines label as the current address
+ *    name = expr         defines (or redefines) a constant
+ *    DB expr, ...        emits bytes
+ *    DW expr, ...        emits big-endian words
+ *    DS count            emits count zero bytes
+ *    ORG expr            moves the current address
+ *    MACRO name a, b     starts a macro, ENDM ends it; \a and \b in the
+ *                        body are replaced by the arguments of each use
+ *    REPT count[, i]     repeats the lines up to ENDR count times, with \i
+ *                        replaced by the iteration number
+ *
+ *  Comments start with ';'. REPT counts must be known when they're reached,
+ *  so they can only use constants defined above them.
+ *
+ *  Usage: chip8-asm [-o rom.ch8] source.asm
+ */
+
+#define MAX_LINE (256)
+#define MAX_NAME (32)
+#define MAX_SYMBOLS (4096)
+#define MAX_MACROS (256)
+#define MAX_PARAMS (8)
+#define MAX_OPERANDS (16)
+#define MAX_DEPTH (16) // Nested macro uses and repeats
+#define MAX_PASSES (16)
+
+typedef struct line {
+  char *text;
+  int number; // Source line, for errors
+} line_t;
+
+typedef struct lines {
+  line_t *line;
+  int count;
+  int capacity;
+} lines_t;
+
+typedef struct symbol {
+  char name[MAX_NAME];
+  long value;
+  bool label;
+  int pass; // Last pass that defined it
+} symbol_t;
+
+typedef struct macro {
+  char name[MAX_NAME];
+  char params[MAX_PARAMS][MAX_NAME];
+  int param_count;
+  lines_t body;
+} macro_t;
+
+static const char *reserved[] = {
+  "I", "DT", "ST", "K", "F", "HF", "B", "R"
+};
+
+static const char *file_name;
+static int line_number;
+static int errors = 0;
+
+static symbol_t symbols[MAX_SYMBOLS];
+static int symbol_count = 0;
+static macro_t macros[MAX_MACROS];
+static int macro_count = 0;
+
+static int pass = 0;
+static bool final_pass = false;
+static bool changed = false; // A label moved during this pass
+static bool unresolved = false; // The last expression used an unknown name
+
+static unsigned char image[RAM_SIZE];
+static long address;
+static long image_end;
+
+static void error(const char *, ...);
+static void add_line(lines_t *, const char *, int);
+static void free_lines(lines_t *);
+static char *trim(char *);
+static void first_word(const char *, char *, size_t);
+static int find_end(const lines_t *, int, const char *, const char *);
+static void substitute(const lines_t *, int, int, char (*)[MAX_NAME],
+                       char (*)[MAX_LINE], int, lines_t *);
+static void expand(const lines_t *, int, lines_t *);
+static symbol_t *find_symbol(const char *);
+static void define(const char *, long, bool);
+static bool is_reserved(const char *);
+static bool parse_value(const char **, long *);
+static bool parse_expr(const char **, long *);
+static bool eval(const char *, long *);
+static int split(char *, char **, int);
+static bool match_operand(const char *, const char *, long *, int *);
+static void assemble_instruction(char *, char *);
+static void assemble_line(char *);
+static void emit(long);
+
+int main(int argc, char *argv[]) {
+  const char *out_name = NULL;
+  char default_name[MAX_LINE];
+
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+      out_name = argv[++i];
+    } else {
+      file_name = argv[i];
+    }
+  }
+
+  if (!file_name) {
+    fprintf(stderr, "Usage: %s [-o rom.ch8] source.asm\n", argv[0]);
+    return 1;
+  }
+
+  if (!out_name) {
+    snprintf(default_name, sizeof(default_name), "%s", file_name);
+    char *dot = strrchr(default_name, '.');
+    if (dot) {
+      *dot = '\0';
+    }
+    strncat(default_name, ".ch8", sizeof(default_name) -
+            strlen(default_name) - 1);
+    out_name = default_name;
+  }
+
+  FILE *source = fopen(file_name, "r");
+  if (!source) {
+    fprintf(stderr, "Can't open %s\n", file_name);
+    return 1;
+  }
+
+  lines_t text = { 0 };
+  char buf[MAX_LINE];
+  int number = 0;
+  while (fgets(buf, sizeof(buf), source)) {
+    number++;
+    if (!strchr(buf, '\n') && !feof(source)) {
+      line_number = number;
+      error("Line too long");
+      break;
+    }
+    add_line(&text, buf, number);
+  }
+  fclose(source);
+
+  // Macros and repeats are expanded once, then the flat program is
+  // assembled until no label moves and once more for real.
+  lines_t program = { 0 };
+  expand(&text, 0, &program);
+  free_lines(&text);
+
+  for (pass = 1; (errors == 0) && (pass <= MAX_PASSES + 1); pass++) {
+    final_pass = (pass > 1) && !changed;
+    changed = false;
+    address = ROM_START;
+    image_end = ROM_START;
+    memset(image, 0, sizeof(image));
+
+    for (int i = 0; i < program.count; i++) {
+      line_number = program.line[i].number;
+      strcpy(buf, program.line[i].text);
+      assemble_line(buf);
+    }
+
+    if (final_pass) {
+      break;
+    }
+  }
+  free_lines(&program);
+
+  if (!final_pass && (errors == 0)) {
+    fprintf(stderr, "%s: labels didn't settle after %d passes\n", file_name,
+            MAX_PASSES);
+    return 1;
+  }
+
+  if (errors > 0) {
+    return 1;
+  }
+
+  FILE *rom = fopen(out_name, "wb");
+  if (!rom) {
+    fprintf(stderr, "Can't write %s\n", out_name);
+    return 1;
+  }
+  fwrite(image + ROM_START, 1, image_end - ROM_START, rom);
+  fclose(rom);
+
+  printf("%s: %ld bytes\n", out_name, image_end - ROM_START);
+  return 0;
+} /* main() */
+
+/*
+ *  Reports an error at the current line. During the sizing passes errors
+ *  are ignored, since labels further down don't have their values yet.
+ */
+
+static void error(const char *format, ...) {
+  va_list args;
+
+  if (!final_pass && (pass > 0)) {
+    return;
+  }
+
+  fprintf(stderr, "%s:%d: ", file_name, line_number);
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  errors++;
+} /* error() */
+
+/*
+ *  Appends a copy of text to lines.
+ */
+
+static void add_line(lines_t *lines, const char *text, int number) {
+  if (lines->count == lines->capacity) {
+    lines->capacity = lines->capacity ? lines->capacity * 2 : 256;
+    lines->line = realloc(lines->line, lines->capacity * sizeof(line_t));
+  }
+
+  size_t len = strcspn(text, "\r\n");
+  char *copy = malloc(len + 1);
+  memcpy(copy, text, len);
+  copy[len] = '\0';
+
+  lines->line[lines->count].text = copy;
+  lines->line[lines->count].number = number;
+  lines->count++;
+} /* add_line() */
+
+/*
+ *  Frees the lines and their text.
+ */
+
+static void free_lines(lines_t *lines) {
+  for (int i = 0; i < lines->count; i++) {
+    free(lines->line[i].text);
+  }
+  free(lines->line);
+  lines->line = NULL;
+  lines->count = 0;
+  lines->capacity = 0;
+} /* free_lines() */
+
+/*
+ *  Strips the comment and surrounding whitespace from a line in place.
+ */
+
+static char *trim(char *text) {
+  char *comment = strchr(text, ';');
+  if (comment) {
+    *comment = '\0';
+  }
+
+  while (isspace((unsigned char) *text)) {
+    text++;
+  }
+
+  size_t len = strlen(text);
+  while ((len > 0) && isspace((unsigned char) text[len - 1])) {
+    text[--len] = '\0';
+  }
+  return text;
+} /* trim() */
+
+/*
+ *  Returns the first word of text, upper cased, in word.
+ */
+
+static void first_word(const char *text, char *word, size_t size) {
+  size_t len = 0;
+  while (text[len] && !isspace((unsigned char) text[len]) &&
+         (len + 1 < size)) {
+    word[len] = toupper((unsigned char) text[len]);
+    len++;
+  }
+  word[len] = '\0';
+} /* first_word() */
+
+/*
+ *  Finds the line closing the block opened on line start, counting nested
+ *  blocks. Returns -1 if it isn't closed.
+ */
+
+static int find_end(const lines_t *lines, int start, const char *open,
+                    const char *close) {
+  int depth = 0;
+
+  for (int i = start; i < lines->count; i++) {
+    char buf[MAX_LINE];
+    char word[MAX_NAME];
+    strcpy(buf, lines->line[i].text);
+    first_word(trim(buf), word, sizeof(word));
+
+    if (strcmp(word, open) == 0) {
+      depth++;
+    } else if ((strcmp(word, close) == 0) && (--depth == 0)) {
+      return i;
+    }
+  }
+  return -1;
+} /* find_end() */
+
+/*
+ *  Copies lines[start, end) into out, replacing each \name with its value.
+ */
+
+static void substitute(const lines_t *lines, int start, int end,
+                       char (*names)[MAX_NAME], char (*values)[MAX_LINE],
+                       int count, lines_t *out) {
+  for (int i = start; i < end; i++) {
+    const char *in = lines->line[i].text;
+    char buf[MAX_LINE];
+    size_t len = 0;
+
+    while (*in && (len + 1 < sizeof(buf))) {
+      int found = -1;
+      if (*in == '\\') {
+        for (int j = 0; j < count; j++) {
+          size_t name_len = strlen(names[j]);
+          if ((strncmp(in + 1, names[j], name_len) == 0) &&
+              !isalnum((unsigned char) in[1 + name_len]) &&
+              (in[1 + name_len] != '_')) {
+            found = j;
+            break;
+          }
+        }
+      }
+
+      if (found < 0) {
+        buf[len++] = *in++;
+        continue;
+      }
+
+      len += snprintf(buf + len, sizeof(buf) - len, "%s", values[found]);
+      if (len >= sizeof(buf)) {
+        len = sizeof(buf) - 1;
+      }
+      in += 1 + strlen(names[found]);
+    }
+    buf[len] = '\0';
+
+    add_line(out, buf, lines->line[i].number);
+  }
+} /* substitute() */
+
+/*
+ *  Expands macro definitions, macro uses and repeats in lines into out.
+ */
+
+static void expand(const lines_t *lines, int depth, lines_t *out) {
+  if (depth > MAX_DEPTH) {
+    error("Macros nested too deeply");
+    return;
+  }
+
+  for (int i = 0; i < lines->count; i++) {
+    char buf[MAX_LINE];
+    char word[MAX_NAME];
+    line_number = lines->line[i].number;
+    strcpy(buf, lines->line[i].text);
+    char *text = trim(buf);
+    first_word(text, word, sizeof(word));
+    char *rest = trim(text + strlen(word));
+
+    if (strcmp(word, "MACRO") == 0) {
+      int end = find_end(lines, i, "MACRO", "ENDM");
+      if (end < 0) {
+        error("MACRO without ENDM");
+        return;
+      }
+      if (macro_count == MAX_MACROS) {
+        error("Too many macros");
+        return;
+      }
+
+      // The name is followed by the parameters, separated by commas.
+      char *params = rest + strcspn(rest, " \t");
+      if (*params) {
+        *params++ = '\0';
+      }
+      char *names[MAX_PARAMS];
+      int count = split(params, names, MAX_PARAMS);
+      if (!*rest || (count > MAX_PARAMS)) {
+        error("Bad MACRO");
+        return;
+      }
+
+      macro_t *macro = &macros[macro_count++];
+      snprintf(macro->name, sizeof(macro->name), "%s", rest);
+      for (int j = 0; j < count; j++) {
+        snprintf(macro->params[j], MAX_NAME, "%s", names[j]);
+      }
+      macro->param_count = count;
+      memset(&macro->body, 0, sizeof(macro->body));
+      substitute(lines, i + 1, end, NULL, NULL, 0, &macro->body);
+      i = end;
+      continue;
+    }
+
+    if (strcmp(word, "REPT") == 0) {
+      int end = find_end(lines, i, "REPT", "ENDR");
+      if (end < 0) {
+        error("REPT without ENDR");
+        return;
+      }
+
+      char *args[2];
+      long count;
+      int arg_count = split(rest, args, 2);
+      unresolved = false;
+      bool known = (arg_count >= 1) && eval(args[0], &count) && !unresolved;
+      if (!known || (count < 0)) {
+        error("REPT needs a known count");
+        i = end;
+        continue;
+      }
+
+      char names[1][MAX_NAME];
+      char values[1][MAX_LINE];
+      snprintf(names[0], MAX_NAME, "%s", (arg_count > 1) ? args[1] : "");
+      for (long k = 0; k < count; k++) {
+        lines_t body = { 0 };
+        snprintf(values[0], MAX_LINE, "%ld", k);
+        substitute(lines, i + 1, end, names, values, arg_count - 1, &body);
+        expand(&body, depth + 1, out);
+        free_lines(&body);
+      }
+      i = end;
+      continue;
+    }
+
+    macro_t *macro = NULL;
+    for (int j = 0; j < macro_count; j++) {
+      if (strcasecmp(macros[j].name, word) == 0) {
+        macro = &macros[j];
+        break;
+      }
+    }
+
+    if (macro) {
+      char *args[MAX_PARAMS];
+      int count = *rest ? split(rest, args, MAX_PARAMS) : 0;
+      if (count != macro->param_count) {
+        error("%s takes %d arguments", macro->name, macro->param_count);
+        continue;
+      }
+
+      char values[MAX_PARAMS][MAX_LINE];
+      for (int j = 0; j < count; j++) {
+        snprintf(values[j], MAX_LINE, "%s", args[j]);
+      }
+
+      lines_t body = { 0 };
+      substitute(&macro->body, 0, macro->body.count, macro->params, values,
+                 count, &body);
+      expand(&body, depth + 1, out);
+      free_lines(&body);
+      continue;
+    }
+
+    // Constants are defined as they're reached so REPT counts can use
+    // them, and again in every pass in case they depend on labels.
+    char *equals = strchr(text, '=');
+    if (equals) {
+      long value;
+      *equals = '\0';
+      unresolved = false;
+      if (eval(equals + 1, &value) && !unresolved) {
+        define(trim(text), value, false);
+      }
+    }
+
+    add_line(out, lines->line[i].text, lines->line[i].number);
+  }
+} /* expand() */
+
+/*
+ *  Looks up a symbol by name, NULL if it isn't defined.
+ */
+
+static symbol_t *find_symbol(const char *name) {
+  for (int i = 0; i < symbol_count; i++) {
+    if (strcmp(symbols[i].name, name) == 0) {
+      return &symbols[i];
+    }
+  }
+  return NULL;
+} /* find_symbol() */
+
+/*
+ *  Defines a label or constant. Labels can only be defined once per pass,
+ *  and a label that moves between passes needs another pass.
+ */
+
+static void define(const char *name, long value, bool label) {
+  symbol_t *symbol = find_symbol(name);
+
+  if (!isalpha((unsigned char) name[0]) && (name[0] != '_')) {
+    error("Bad name '%s'", name);
+    return;
+  }
+  if (is_reserved(name)) {
+    error("'%s' is reserved", name);
+    return;
+  }
+
+  if (!symbol) {
+    if (symbol_count == MAX_SYMBOLS) {
+      error("Too many symbols");
+      return;
+    }
+    symbol = &symbols[symbol_count++];
+    snprintf(symbol->name, sizeof(symbol->name), "%s", name);
+    symbol->label = label;
+    symbol->pass = -1;
+  } else if (label && (symbol->pass == pass)) {
+    error("'%s' is already defined", name);
+    return;
+  }
+
+  if (label && (symbol->value != value)) {
+    changed = true;
+  }
+  symbol->value = value;
+  symbol->label = label;
+  symbol->pass = pass;
+} /* define() */
+
+/*
+ *  Returns whether name is a register or other operand keyword.
+ */
+
+static bool is_reserved(const char *name) {
+  if ((toupper((unsigned char) name[0]) == 'V') &&
+      isxdigit((unsigned char) name[1]) && !name[2]) {
+    return true;
+  }
+
+  for (size_t i = 0; i < sizeof(reserved) / sizeof(reserved[0]); i++) {
+    if (strcasecmp(name, reserved[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+} /* is_reserved() */
+
+/*
+ *  Parses a number, name or parenthesized expression, with unary minus.
+ */
+
+static bool parse_value(const char **s, long *value) {
+  while (isspace((unsigned char) **s)) {
+    (*s)++;
+  }
+
+  if (**s == '-') {
+    (*s)++;
+    if (!parse_value(s, value)) {
+      return false;
+    }
+    *value = -*value;
+    return true;
+  }
+
+  if (**s == '(') {
+    (*s)++;
+    if (!parse_expr(s, value)) {
+      return false;
+    }
+    while (isspace((unsigned char) **s)) {
+      (*s)++;
+    }
+    if (**s != ')') {
+      return false;
+    }
+    (*s)++;
+    return true;
+  }
+
+  if (isdigit((unsigned char) **s)) {
+    char *end;
+    if (((*s)[0] == '0') && (toupper((unsigned char) (*s)[1]) == 'B')) {
+      *value = strtol(*s + 2, &end, 2);
+    } else {
+      *value = strtol(*s, &end, 0);
+    }
+    if (isalnum((unsigned char) *end)) {
+      return false;
+    }
+    *s = end;
+    return true;
+  }
+
+  if (isalpha((unsigned char) **s) || (**s == '_')) {
+    char name[MAX_NAME];
+    size_t len = 0;
+    while ((isalnum((unsigned char) **s) || (**s == '_')) &&
+           (len + 1 < sizeof(name))) {
+      name[len++] = *(*s)++;
+    }
+    name[len] = '\0';
+
+    if (is_reserved(name)) {
+      return false;
+    }
+
+    symbol_t *symbol = find_symbol(name);
+    if (!symbol) {
+      unresolved = true;
+      *value = 0;
+    } else {
+      *value = symbol->value;
+    }
+    return true;
+  }
+
+  return false;
+} /* parse_value() */
+
+/*
+ *  Parses products and sums of values, left to right.
+ */
+
+static bool parse_expr(const char **s, long *value) {
+  long term;
+
+  if (!parse_value(s, &term)) {
+    return false;
+  }
+
+  *value = 0;
+  char op = '+';
+  while (true) {
+    while (isspace((unsigned char) **s)) {
+      (*s)++;
+    }
+
+    char next = **s;
+    if ((next == '*') || (next == '/') || (next == '%')) {
+      long factor;
+      (*s)++;
+      if (!parse_value(s, &factor)) {
+        return false;
+      }
+      if ((next != '*') && (factor == 0)) {
+        return false;
+      }
+      term = (next == '*') ? term * factor :
+             (next == '/') ? term / factor : term % factor;
+      continue;
+    }
+
+    *value = (op == '+') ? *value + term : *value - term;
+    if ((next != '+') && (next != '-')) {
+      return true;
+    }
+
+    op = next;
+    (*s)++;
+    if (!parse_value(s, &term)) {
+      return false;
+    }
+  }
+} /* parse_expr() */
+
+/*
+ *  Evaluates all of text as an expression. Names that aren't defined yet
+ *  count as 0 and set unresolved, which callers clear beforehand.
+ */
+
+static bool eval(const char *text, long *value) {
+  if (!parse_expr(&text, value)) {
+    return false;
+  }
+
+  while (isspace((unsigned char) *text)) {
+    text++;
+  }
+  return *text == '\0';
+} /* eval() */
+
+/*
+ *  Splits text at commas into at most max trimmed fields. Returns the number
+ *  of fields, or max + 1 if there are more.
+ */
+
+static int split(char *text, char **fields, int max) {
+  int count = 0;
+
+  if (!*trim(text)) {
+    return 0;
+  }
+
+  while (true) {
+    char *comma = strchr(text, ',');
+    if (comma) {
+      *comma = '\0';
+    }
+    if (count == max) {
+      return max + 1;
+    }
+    fields[count++] = trim(text);
+    if (!comma) {
+      return count;
+    }
+    text = comma + 1;
+  }
+} /* split() */
+
+/*
+ *  Matches one operand against its pattern from the format table, filling
+ *  in fields: [0] X, [1] Y, [2] the value. Sets *range when the operand has
+ *  the right shape but its value doesn't fit.
+ */
+
+static bool match_operand(const char *pattern, const char *text,
+                          long *fields, int *range) {
+  while (*pattern) {
+    if (*pattern != '%') {
+      if (toupper((unsigned char) *pattern) != toupper((unsigned char) *text)) {
+        return false;
+      }
+      pattern++;
+      text++;
+      continue;
+    }
+
+    char kind = pattern[1];
+    pattern += 2;
+
+    if ((kind == 'X') || (kind == 'Y')) {
+      if (!isxdigit((unsigned char) *text)) {
+        return false;
+      }
+      char digit[2] = { *text++, '\0' };
+      fields[kind == 'Y'] = strtol(digit, NULL, 16);
+      continue;
+    }
+
+    // Values always end the operand.
+    long value;
+    if (!eval(text, &value)) {
+      return false;
+    }
+
+    long min = (kind == 'B') ? -128 : 0;
+    long max = (kind == 'N') ? 0xF : (kind == 'B') ? 0xFF :
+               (kind == 'A') ? 0xFFF : 0xFFFF;
+    if ((value < min) || (value > max)) {
+      *range = 1;
+      return false;
+    }
+    fields[2] = value & max;
+    return true;
+  }
+
+  return *text == '\0';
+} /* match_operand() */
+
+/*
+ *  Encodes an instruction by trying each format in the table.
+ */
+
+static void assemble_instruction(char *mnemonic, char *operands) {
+  char *args[MAX_OPERANDS];
+  int arg_count = split(operands, args, MAX_OPERANDS);
+  bool known = false;
+  int range = 0;
+
+  unresolved = false;
+
+  for (size_t i = 0; opcode_format(i); i++) {
+    const opcode_format_t *format = opcode_format(i);
+    char pattern[MAX_LINE];
+    snprintf(pattern, sizeof(pattern), "%s", format->format);
+
+    char *space = strchr(pattern, ' ');
+    if (space) {
+      *space = '\0';
+    }
+    if (strcasecmp(pattern, mnemonic) != 0) {
+      continue;
+    }
+    known = true;
+
+    char *patterns[MAX_OPERANDS];
+    int pattern_count = space ? split(space + 1, patterns, MAX_OPERANDS) : 0;
+    if (pattern_count != arg_count) {
+      continue;
+    }
+
+    long fields[3] = { 0 };
+    bool matched = true;
+    unresolved = false;
+    bool long_operand = false;
+    for (int j = 0; matched && (j < arg_count); j++) {
+      matched = match_operand(patterns[j], args[j], fields, &range);
+      long_operand |= (strstr(patterns[j], "%L") != NULL);
+    }
+    if (!matched) {
+      continue;
+    }
+
+    unsigned short opcode = format->match | fields[0] << 8 | fields[1] << 4;
+    if (long_operand) {
+      emit(opcode >> 8);
+      emit(opcode & 0xFF);
+      opcode = fields[2];
+    } else {
+      opcode |= fields[2] & ~format->mask;
+    }
+    emit(opcode >> 8);
+    emit(opcode & 0xFF);
+    return;
+  }
+
+  if (!known) {
+    error("Unknown instruction '%s'", mnemonic);
+  } else if (range) {
+    error("Value out of range for %s", mnemonic);
+  } else {
+    error("Bad operands for %s", mnemonic);
+  }
+
+  // Keep later addresses where they'd be.
+  emit(0);
+  emit(0);
+} /* assemble_instruction() */
+
+/*
+ *  Assembles one line of the expanded program.
+ */
+
+static void assemble_line(char *line) {
+  char *text = trim(line);
+  char word[MAX_NAME];
+
+  // Labels, possibly followed by an instruction
+  char *colon = strchr(text, ':');
+  if (colon) {
+    *colon = '\0';
+    define(trim(text), address, true);
+    text = trim(colon + 1);
+  }
+
+  if (!*text) {
+    return;
+  }
+
+  char *equals = strchr(text, '=');
+  if (equals) {
+    long value;
+    *equals = '\0';
+    unresolved = false;
+    if (!eval(equals + 1, &value)) {
+      error("Bad expression");
+    } else if (unresolved && final_pass) {
+      error("Undefined name in expression");
+    } else {
+      define(trim(text), value, false);
+    }
+    return;
+  }
+
+  first_word(text, word, sizeof(word));
+  char *rest = trim(text + strlen(word));
+
+  if ((strcmp(word, "DB") == 0) || (strcmp(word, "DW") == 0) ||
+      (strcmp(word, "DS") == 0) || (strcmp(word, "ORG") == 0)) {
+    char *args[MAX_OPERANDS * 4];
+    int count = split(rest, args, MAX_OPERANDS * 4);
+    if ((count == 0) || (count > MAX_OPERANDS * 4) ||
+        ((strcmp(word, "DS") == 0 || strcmp(word, "ORG") == 0) &&
+         (count != 1))) {
+      error("Bad %s", word);
+      return;
+    }
+
+    for (int i = 0; i < count; i++) {
+      long value;
+      unresolved = false;
+      if (!eval(args[i], &value)) {
+        error("Bad expression '%s'", args[i]);
+        continue;
+      }
+      if (unresolved && final_pass) {
+        error("Undefined name in '%s'", args[i]);
+      }
+
+      if (strcmp(word, "DB") == 0) {
+        emit(value & 0xFF);
+      } else if (strcmp(word, "DW") == 0) {
+        emit((value >> 8) & 0xFF);
+        emit(value & 0xFF);
+      } else if (strcmp(word, "DS") == 0) {
+        for (long j = 0; j < value; j++) {
+          emit(0);
+        }
+      } else if ((value < ROM_START) || (value > RAM_SIZE)) {
+        error("ORG outside the rom");
+      } else {
+        address = value;
+      }
+    }
+    return;
+  }
+
+  char operands[MAX_LINE];
+  strcpy(operands, rest);
+  assemble_instruction(word, rest);
+  if (unresolved && final_pass) {
+    error("Undefined name in '%s'", operands);
+  }
+} /* assemble_line() */
+
+/*
+ *  Writes a byte at the current address.
+ */
+
+static void emit(long value) {
+  if (address >= RAM_SIZE) {
+    error("Rom doesn't fit in memory");
+    return;
+  }
+
+  image[address++] = value;
+  if (address > image_end) {
+    image_end = address;
+  }
+} /* emit() */
@@ -0,0 +1,207 @@
+#include "chip8.h"
+#include "clone.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ *  Throughput benchmark. Each rom runs once as a single machine, and once
+ *  as many machines stepped a frame at a time in turn, which is how batch
+ *  users like the gym drive the core and where the layout of ch8_t
+ *  matters most, and once more as that many copy-on-write clones run in
+ *  turn through one workspace, which is how a host keeps far more machines
+ *  than fit as ch8_t. Reports emulated instructions per second, the best
+ *  of RUNS runs to keep noise from other processes out, and the memory
+ *  each clone ends up taking.
+ *
+ *  Usage: chip8-bench [-n instances] [-f frames] rom...
+ */
+
+#define DEFAULT_INSTANCES (1024)
+#define DEFAULT_FRAMES (200000) // Frames run in total by each test
+#define RUNS (5)
+
+static double best(const char *, int, int, size_t *);
+static double run(const char *, int, int);
+static double run_clones(const char *, int, int, size_t *);
+static double now(void);
+
+int main(int argc, char *argv[]) {
+  int instances = DEFAULT_INSTANCES;
+  int frames = DEFAULT_FRAMES;
+  int roms = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      instances = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "-f") == 0) && (i + 1 < argc)) {
+      frames = atoi(argv[++i]);
+    } else {
+      argv[++roms] = argv[i];
+    }
+  }
+
+  if ((roms == 0) || (instances < 1) || (frames < instances)) {
+    fprintf(stderr, "Usage: %s [-n instances] [-f frames] rom...\n",
+            argv[0]);
+    return 1;
+  }
+
+  printf("%-24s %14s %14s %14s %10s\n", "rom", "1 machine", "machines",
+         "clones", "bytes each");
+  for (int i = 1; i <= roms; i++) {
+    size_t clone_size = 0;
+    double single = best(argv[i], 1, frames, NULL);
+    double multi = best(argv[i], instances, frames, NULL);
+    double clones = best(argv[i], instances, frames, &clone_size);
+    if ((single < 0) || (clones < 0)) {
+      printf("%-24s can't load\n", argv[i]);
+      continue;
+    }
+    // A million machines as ch8_t won't fit where their clones do
+    printf("%-24s %9.1f MIPS ", argv[i], single / 1e6);
+    if (multi < 0) {
+      printf("%14s ", "no memory");
+    } else {
+      printf("%9.1f MIPS ", multi / 1e6);
+    }
+    printf("%9.1f MIPS %10zu\n", clones / 1e6, clone_size);
+  }
+  printf("(%d machines and clones, %zu bytes each as ch8_t)\n", instances,
+         sizeof(ch8_t));
+  return 0;
+} /* main() */
+
+/*
+ *  Returns the best of RUNS runs, of clones if clone_size isn't NULL.
+ */
+
+static double best(const char *rom_name, int count, int frames,
+                   size_t *clone_size) {
+  double result = -1;
+
+  for (int i = 0; i < RUNS; i++) {
+    double rate = clone_size ?
+                  run_clones(rom_name, count, frames, clone_size) :
+                  run(rom_name, count, frames);
+    if (rate > result) {
+      result = rate;
+    }
+  }
+  return result;
+} /* best() */
+
+/*
+ *  Runs a rom on count machines for frames frames between them, and
+ *  returns the instructions run per second, or -1 if it can't be loaded.
+ */
+
+static double run(const char *rom_name, int count, int frames) {
+  ch8_t *machines = alloc_machines(count);
+  bool draw_flag = false;
+
+  if (!machines) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    initialize(&machines[i], DEFAULT_SEED + i);
+    if (!load_rom(&machines[i], rom_name)) {
+      free(machines);
+      return -1;
+    }
+  }
+
+  double start = now();
+  for (int f = 0; f < frames / count; f++) {
+    for (int i = 0; i < count; i++) {
+      run_frame(&machines[i], &draw_flag);
+    }
+  }
+  double elapsed = now() - start;
+
+  free(machines);
+  return (double) (frames / count) * count * CYCLES_PER_FRAME / elapsed;
+} /* run() */
+
+/*
+ *  Like run(), but with count clones of one machine, each seeded apart and
+ *  loaded into a workspace to run its frame. Sets clone_size to the bytes
+ *  each clone takes on average at the end.
+ */
+
+static double run_clones(const char *rom_name, int count, int frames,
+                         size_t *clone_size) {
+  ch8_t *machine = alloc_machines(1);
+  ch8_cow_t root;
+  bool draw_flag = false;
+
+  if (!machine) {
+    return -1;
+  }
+  initialize(machine, DEFAULT_SEED);
+  bool loaded = load_rom(machine, rom_name) && cow_init(&root, machine);
+  free(machine);
+  if (!loaded) {
+    return -1;
+  }
+
+  ch8_cow_t *clones = calloc(count, sizeof(ch8_cow_t));
+  cow_workspace_t *work = aligned_alloc(CACHE_LINE, sizeof(cow_workspace_t));
+  bool saved = clones && work;
+
+  if (work) {
+    cow_workspace_init(work);
+  }
+  for (int i = 0; saved && (i < count); i++) {
+    cow_load(work, &root);
+    work->machine.rng = DEFAULT_SEED + i;
+    saved = cow_save(&clones[i], work);
+  }
+  cow_release(&root);
+
+  double start = now();
+  for (int f = 0; saved && (f < frames / count); f++) {
+    for (int i = 0; saved && (i < count); i++) {
+      cow_load(work, &clones[i]);
+      run_frame(&work->machine, &draw_flag);
+      cow_release(&clones[i]);
+      saved = cow_save(&clones[i], work);
+    }
+  }
+  double elapsed = now() - start;
+
+  // Measured without the workspace's references, as if it were shut down
+  if (work) {
+    cow_workspace_free(work);
+  }
+  if (saved) {
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+      total += cow_size(&clones[i]);
+    }
+    *clone_size = total / count;
+  }
+
+  for (int i = 0; clones && (i < count); i++) {
+    cow_release(&clones[i]);
+  }
+  free(clones);
+  free(work);
+  if (!saved) {
+    return -1;
+  }
+  return (double) (frames / count) * count * CYCLES_PER_FRAME / elapsed;
+} /* run_clones() */
+
+/*
+ *  Monotonic time in seconds.
+ */
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+} /* now() */
@@ -0,0 +1,26 @@
+; Arithmetic heavy workload: unrolled 8XYN register mixes with no drawing.
+
+MACRO mix a, b
+  ADD \a, \b
+  SUB \b, \a
+  XOR \a, \b
+  SHR \a, \b
+  OR \b, \a
+  SUBN \a, \b
+  AND \b, \a
+  SHL \a, \b
+ENDM
+
+start:
+  LD V0, 0x13
+  LD V1, 0x37
+  LD V2, 0x5A
+  LD V3, 0xC3
+loop:
+  REPT 32, n
+    mix V0, V1
+    ADD V2, \n
+    mix V2, V3
+    mix V1, V2
+  ENDR
+  JP loop
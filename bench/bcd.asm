@@ -0,0 +1,18 @@
+; BCD heavy workload: FX33 conversions of varying values, each read back
+; with FX65 so the stored digits feed the next value.
+
+start:
+  LD V3, 0
+loop:
+  REPT 64, n
+    LD V0, (\n * 37 + 11) % 256
+    ADD V0, V3
+    LD I, digits
+    LD B, V0
+    LD V2, [I]
+    ADD V3, V2
+  ENDR
+  JP loop
+
+digits:
+  DS 3
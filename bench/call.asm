@@ -0,0 +1,23 @@
+; Call heavy workload: unrolled calls into a recursive subroutine, nesting
+; from 1 up to 15 deep so the stack is nearly full at the bottom.
+
+start:
+  LD V0, 0
+loop:
+  REPT 64, n
+    LD V1, \n % 15
+    CALL descend
+  ENDR
+  JP loop
+
+; Recurses V1 more levels, counting calls in V0.
+descend:
+  ADD V0, 1
+  SE V1, 0
+  JP deeper
+  RET
+deeper:
+  ADD V1, -1
+  CALL descend
+  ADD V1, 1
+  RET
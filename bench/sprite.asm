@@ -0,0 +1,21 @@
+; Sprite heavy workload: unrolled DXYN draws across the screen, alternating
+; sprite heights so both the short and long row paths are exercised.
+
+MACRO sprite x, y, rows
+  LD V0, \x
+  LD V1, \y
+  DRW V0, V1, \rows
+ENDM
+
+start:
+  CLS
+  LD I, ball
+loop:
+  REPT 64, n
+    sprite (\n * 7) % 64, (\n * 5) % 32, \n % 15 + 1
+  ENDR
+  JP loop
+
+ball:
+  DB 0x3C, 0x7E, 0xFF, 0xFF, 0xFF, 0xFF, 0x7E, 0x3C
+  DB 0x3C, 0x7E, 0xFF, 0xFF, 0xFF, 0xFF, 0x7E
@@ -0,0 +1,362 @@
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_RATE_NUM (60)
+#define DEFLATE_BLOCK (65535) // Largest stored block
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void *writer(void *);
+static void rasterize(const capture_t *, const capture_frame_t *,
+                      unsigned char *);
+static bool write_y4m(capture_t *, const unsigned char *);
+static bool write_png(capture_t *, const unsigned char *);
+static void crc_init(void);
+static uint32_t png_crc(uint32_t, const unsigned char *, size_t);
+static bool write_chunk(FILE *, const char *, const unsigned char *, size_t);
+static void put_u32(unsigned char *, uint32_t);
+
+/*
+ *  Starts a capture. A name ending in .y4m writes a Y4M stream, anything
+ *  else is a printf pattern for numbered PNG files, e.g. frame%05d.png.
+ *  The palette gives the color of each combination of planes.
+ */
+
+bool capture_open(capture_t *capture, const char *name, int scale,
+                  const unsigned char (*palette)[3]) {
+  size_t len = strlen(name);
+
+  memset(capture, 0, sizeof(*capture));
+  capture->format = ((len > 4) && (strcmp(name + len - 4, ".y4m") == 0))
+                    ? CAPTURE_Y4M : CAPTURE_PNG;
+  snprintf(capture->name, sizeof(capture->name), "%s", name);
+  capture->scale = (scale < 1) ? 1 : scale;
+  capture->width = DISPLAY_WIDTH * capture->scale;
+  capture->height = DISPLAY_HEIGHT * capture->scale;
+  memcpy(capture->palette, palette, sizeof(capture->palette));
+
+  if (capture->format == CAPTURE_Y4M) {
+    capture->file = fopen(name, "wb");
+    if (!capture->file) {
+      return false;
+    }
+    fprintf(capture->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+            capture->width, capture->height, FRAME_RATE_NUM);
+  } else if (!strchr(name, '%')) {
+    return false;
+  }
+
+  pthread_mutex_init(&capture->lock, NULL);
+  pthread_cond_init(&capture->ready, NULL);
+  pthread_cond_init(&capture->space, NULL);
+  pthread_create(&capture->writer, NULL, writer, capture);
+  return true;
+} /* capture_open() */
+
+/*
+ *  Queues the current framebuffer. When the queue is full this either waits
+ *  for the writer or drops the frame and returns false.
+ */
+
+bool capture_frame(capture_t *capture, const ch8_t *ch8, bool wait) {
+  pthread_mutex_lock(&capture->lock);
+
+  while (wait && (capture->count == CAPTURE_QUEUE_SIZE)) {
+    pthread_cond_wait(&capture->space, &capture->lock);
+  }
+
+  if (capture->count == CAPTURE_QUEUE_SIZE) {
+    capture->dropped++;
+    pthread_mutex_unlock(&capture->lock);
+    return false;
+  }
+
+  int tail = (capture->head + capture->count) % CAPTURE_QUEUE_SIZE;
+  memcpy(capture->queue[tail].gfx, ch8->gfx, sizeof(ch8->gfx));
+  capture->queue[tail].hires = ch8->hires;
+  capture->count++;
+
+  pthread_cond_signal(&capture->ready);
+  pthread_mutex_unlock(&capture->lock);
+  return true;
+} /* capture_frame() */
+
+/*
+ *  Writes out the queued frames and stops the writer.
+ */
+
+void capture_close(capture_t *capture) {
+  pthread_mutex_lock(&capture->lock);
+  capture->closing = true;
+  pthread_cond_signal(&capture->ready);
+  pthread_mutex_unlock(&capture->lock);
+
+  pthread_join(capture->writer, NULL);
+  pthread_mutex_destroy(&capture->lock);
+  pthread_cond_destroy(&capture->ready);
+  pthread_cond_destroy(&capture->space);
+
+  if (capture->file) {
+    fclose(capture->file);
+    capture->file = NULL;
+  }
+} /* capture_close() */
+
+/*
+ *  Writer thread: encodes frames from the head of the queue until closed.
+ */
+
+static void *writer(void *arg) {
+  capture_t *capture = arg;
+  unsigned char *pixels = malloc(capture->width * capture->height);
+
+  pthread_mutex_lock(&capture->lock);
+  while (true) {
+    while ((capture->count == 0) && !capture->closing) {
+      pthread_cond_wait(&capture->ready, &capture->lock);
+    }
+    if (capture->count == 0) {
+      break;
+    }
+
+    // The slot stays claimed until it's been read, so it can be read
+    // unlocked while the emulation keeps queueing behind it.
+    capture_frame_t *frame = &capture->queue[capture->head];
+    pthread_mutex_unlock(&capture->lock);
+
+    rasterize(capture, frame, pixels);
+    if (!capture->failed) {
+      capture->failed = (capture->format == CAPTURE_Y4M)
+                        ? !write_y4m(capture, pixels)
+                        : !write_png(capture, pixels);
+    }
+
+    pthread_mutex_lock(&capture->lock);
+    capture->head = (capture->head + 1) % CAPTURE_QUEUE_SIZE;
+    capture->count--;
+    capture->frames++;
+    pthread_cond_signal(&capture->space);
+  }
+  pthread_mutex_unlock(&capture->lock);
+
+  free(pixels);
+  return NULL;
+} /* writer() */
+
+/*
+ *  Converts a frame to one palette index per output pixel. Each output pixel
+ *  covers its share of the source pixels in proportion, OR-ing them when it
+ *  covers several, so any scale maps either resolution into the frame.
+ */
+
+static void rasterize(const capture_t *capture, const capture_frame_t *frame,
+                      unsigned char *pixels) {
+  int width = frame->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+  int height = frame->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+  int words = width / 64;
+
+  for (int y = 0; y < capture->height; y++) {
+    int sy0 = y * height / capture->height;
+    int sy1 = (y + 1) * height / capture->height;
+    sy1 = (sy1 > sy0) ? sy1 : sy0 + 1;
+
+    for (int x = 0; x < capture->width; x++) {
+      int sx0 = x * width / capture->width;
+      int sx1 = (x + 1) * width / capture->width;
+      sx1 = (sx1 > sx0) ? sx1 : sx0 + 1;
+
+      int color = 0;
+      for (int p = 0; p < GFX_PLANES; p++) {
+        for (int sy = sy0; sy < sy1; sy++) {
+          for (int sx = sx0; sx < sx1; sx++) {
+            color |= ((frame->gfx[p][sy * words + sx / 64] >>
+                       (63 - sx % 64)) & 1) << p;
+          }
+        }
+      }
+      pixels[y * capture->width + x] = color;
+    }
+  }
+} /* rasterize() */
+
+/*
+ *  Appends a frame to the Y4M stream as 4:4:4 BT.601 YUV.
+ */
+
+static bool write_y4m(capture_t *capture, const unsigned char *pixels) {
+  size_t size = capture->width * capture->height;
+  unsigned char yuv[1 << GFX_PLANES][3];
+
+  for (int i = 0; i < (1 << GFX_PLANES); i++) {
+    int r = capture->palette[i][0];
+    int g = capture->palette[i][1];
+    int b = capture->palette[i][2];
+    yuv[i][0] = 16 + (66 * r + 129 * g + 25 * b + 128) / 256;
+    yuv[i][1] = 128 + (-38 * r - 74 * g + 112 * b + 128) / 256;
+    yuv[i][2] = 128 + (112 * r - 94 * g - 18 * b + 128) / 256;
+  }
+
+  if (fputs("FRAME\n", capture->file) == EOF) {
+    return false;
+  }
+
+  unsigned char *plane = malloc(size);
+  bool ok = true;
+  for (int c = 0; ok && (c < 3); c++) {
+    for (size_t i = 0; i < size; i++) {
+      plane[i] = yuv[pixels[i]][c];
+    }
+    ok = fwrite(plane, 1, size, capture->file) == size;
+  }
+  free(plane);
+
+  return ok;
+} /* write_y4m() */
+
+/*
+ *  Writes a frame to the next numbered file as an indexed color PNG. The
+ *  image data uses stored deflate blocks, trading size for not needing
+ *  zlib; frames are small either way.
+ */
+
+static bool write_png(capture_t *capture, const unsigned char *pixels) {
+  static const unsigned char signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+  };
+  char name[300];
+  snprintf(name, sizeof(name), capture->name, (int) capture->frames);
+
+  FILE *file = fopen(name, "wb");
+  if (!file) {
+    return false;
+  }
+
+  unsigned char header[13];
+  put_u32(header, capture->width);
+  put_u32(header + 4, capture->height);
+  header[8] = 8; // Bit depth
+  header[9] = 3; // Indexed color
+  header[10] = 0; // Deflate
+  header[11] = 0; // Adaptive filtering
+  header[12] = 0; // Not interlaced
+
+  // Each row is a filter type byte (none) followed by the indices.
+  size_t raw_size = (capture->width + 1) * capture->height;
+  size_t blocks = (raw_size + DEFLATE_BLOCK - 1) / DEFLATE_BLOCK;
+  size_t data_size = 2 + raw_size + 5 * blocks + 4;
+  unsigned char *data = malloc(data_size);
+  unsigned char *raw = malloc(raw_size);
+
+  for (int y = 0; y < capture->height; y++) {
+    raw[y * (capture->width + 1)] = 0;
+    memcpy(raw + y * (capture->width + 1) + 1, pixels + y * capture->width,
+           capture->width);
+  }
+
+  size_t len = 0;
+  data[len++] = 0x78; // zlib header, no compression
+  data[len++] = 0x01;
+  uint32_t a = 1;
+  uint32_t b = 0;
+  for (size_t offset = 0; offset < raw_size; offset += DEFLATE_BLOCK) {
+    size_t block = raw_size - offset;
+    if (block > DEFLATE_BLOCK) {
+      block = DEFLATE_BLOCK;
+    }
+    data[len++] = (offset + block == raw_size); // Final block flag
+    data[len++] = block & 0xFF;
+    data[len++] = block >> 8;
+    data[len++] = ~block & 0xFF;
+    data[len++] = (~block >> 8) & 0xFF;
+    memcpy(data + len, raw + offset, block);
+    len += block;
+
+    for (size_t i = 0; i < block; i++) {
+      a = (a + raw[offset + i]) % 65521;
+      b = (b + a) % 65521;
+    }
+  }
+  put_u32(data + len, b << 16 | a); // Adler-32
+  len += 4;
+
+  unsigned char palette[3 << GFX_PLANES];
+  memcpy(palette, capture->palette, sizeof(palette));
+
+  bool ok = (fwrite(signature, 1, sizeof(signature), file) ==
+             sizeof(signature)) &&
+            write_chunk(file, "IHDR", header, sizeof(header)) &&
+            write_chunk(file, "PLTE", palette, sizeof(palette)) &&
+            write_chunk(file, "IDAT", data, len) &&
+            write_chunk(file, "IEND", NULL, 0);
+
+  free(raw);
+  free(data);
+  return (fclose(file) == 0) && ok;
+} /* write_png() */
+
+/*
+ *  Updates a CRC-32 (the PNG and zlib polynomial) with size bytes.
+ */
+
+static uint32_t png_crc(uint32_t crc, const unsigned char *data, size_t size) {
+  pthread_once(&crc_once, crc_init);
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+} /* png_crc() */
+
+/*
+ *  Builds the CRC-32 table, once for all writer threads.
+ */
+
+static void crc_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    }
+    crc_table[i] = c;
+  }
+} /* crc_init() */
+
+/*
+ *  Writes one PNG chunk with its length and CRC.
+ */
+
+static bool write_chunk(FILE *file, const char *type,
+                        const unsigned char *data, size_t size) {
+  unsigned char word[4];
+
+  put_u32(word, size);
+  if (fwrite(word, 1, 4, file) != 4) {
+    return false;
+  }
+
+  uint32_t crc = png_crc(0, (const unsigned char *) type, 4);
+  crc = png_crc(crc, data, size);
+  if ((fwrite(type, 1, 4, file) != 4) ||
+      (size && (fwrite(data, 1, size, file) != size))) {
+    return false;
+  }
+
+  put_u32(word, crc);
+  return fwrite(word, 1, 4, file) == 4;
+} /* write_chunk() */
+
+/*
+ *  Stores a 32-bit value big-endian.
+ */
+
+static void put_u32(unsigned char *buf, uint32_t value) {
+  buf[0] = value >> 24;
+  buf[1] = value >> 16;
+  buf[2] = value >> 8;
+  buf[3] = value;
+} /* put_u32() */
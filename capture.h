@@ -0,0 +1,61 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "chip8.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define CAPTURE_QUEUE_SIZE (64) // Frames buffered for the writer thread
+
+/*
+ *  Video capture of the framebuffer, either as a Y4M stream or as numbered
+ *  PNG files. Frames are copied into a bounded queue and encoded and written
+ *  by a background thread; when the writer falls behind, new frames are
+ *  dropped rather than stalling the emulation, and counted.
+ *
+ *  Every frame is DISPLAY_WIDTH x DISPLAY_HEIGHT pixels times the scale, so
+ *  a Y4M stream keeps one size across resolution switches. High resolution
+ *  frames use half the scale per pixel, are halved by OR-ing 2x2 blocks at
+ *  scale 1, and at odd scales map their pixels in proportion.
+ */
+
+typedef enum capture_format {
+  CAPTURE_Y4M,
+  CAPTURE_PNG
+} capture_format_t;
+
+typedef struct capture_frame {
+  uint64_t gfx[GFX_PLANES][GFX_WORDS];
+  bool hires;
+} capture_frame_t;
+
+typedef struct capture {
+  capture_format_t format;
+  char name[256]; // Y4M file, or printf pattern for PNG files
+  FILE *file;
+  int scale;
+  int width;
+  int height;
+  unsigned char palette[1 << GFX_PLANES][3];
+
+  capture_frame_t queue[CAPTURE_QUEUE_SIZE];
+  int head; // Next frame to write
+  int count;
+  bool closing;
+  pthread_mutex_t lock;
+  pthread_cond_t ready; // Signalled when a frame is queued
+  pthread_cond_t space; // Signalled when a frame is written
+  pthread_t writer;
+
+  unsigned long frames; // Written so far
+  unsigned long dropped;
+  bool failed;
+} capture_t;
+
+bool capture_open(capture_t *, const char *, int,
+                  const unsigned char (*)[3]);
+bool capture_frame(capture_t *, const ch8_t *, bool);
+void capture_close(capture_t *);
+
+#endif
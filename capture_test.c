@@ -0,0 +1,133 @@
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *  Capture test. Runs a high resolution rom headless and captures its last
+ *  frame to a Y4M stream at each scale from 1 to MAX_SCALE, then checks
+ *  every output pixel against the source pixels it should show: the OR of
+ *  a 2x2 block at scale 1, and the one pixel its position maps to in
+ *  proportion at the larger scales, odd ones included.
+ *
+ *  Usage: chip8-capture-test rom [output.y4m]
+ */
+
+#define FRAMES (10)
+#define MAX_SCALE (5)
+
+static const unsigned char palette[1 << GFX_PLANES][3] = {
+  { 0x00, 0x00, 0x00 }, { 0xFF, 0xFF, 0xFF },
+  { 0xFF, 0xFF, 0xFF }, { 0xFF, 0xFF, 0xFF }
+};
+
+static int check_scale(const ch8_t *, const char *, int);
+static bool lit(const ch8_t *, int, int);
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s rom [output.y4m]\n", argv[0]);
+    return 1;
+  }
+  const char *output = (argc > 2) ? argv[2] : "capture-test.y4m";
+
+  ch8_t *ch8 = alloc_machines(1);
+  bool draw_flag = false;
+
+  initialize(ch8, DEFAULT_SEED);
+  if (!load_rom(ch8, argv[1])) {
+    fprintf(stderr, "Can't load %s\n", argv[1]);
+    return 1;
+  }
+  for (int f = 0; f < FRAMES; f++) {
+    run_frame(ch8, &draw_flag);
+  }
+  if (!ch8->hires) {
+    fprintf(stderr, "%s doesn't switch to high resolution\n", argv[1]);
+    return 1;
+  }
+
+  int failed = 0;
+  for (int scale = 1; scale <= MAX_SCALE; scale++) {
+    int differences = check_scale(ch8, output, scale);
+    printf("%s scale %d", (differences == 0) ? "PASS" : "FAIL", scale);
+    if (differences > 0) {
+      printf(": %d pixels differ", differences);
+    } else if (differences < 0) {
+      printf(": can't capture");
+    }
+    printf("\n");
+    failed += differences != 0;
+  }
+  remove(output);
+
+  free(ch8);
+  printf("%d tests, %d failed\n", MAX_SCALE, failed);
+  return failed != 0;
+} /* main() */
+
+/*
+ *  Captures the machine's frame at a scale and returns the number of output
+ *  pixels that don't show what they should, or -1 if it can't be captured.
+ */
+
+static int check_scale(const ch8_t *ch8, const char *output, int scale) {
+  capture_t *capture = malloc(sizeof(capture_t));
+
+  if (!capture || !capture_open(capture, output, scale, palette)) {
+    free(capture);
+    return -1;
+  }
+  int width = capture->width;
+  int height = capture->height;
+  capture_frame(capture, ch8, true);
+  capture_close(capture);
+  bool failed = capture->failed;
+  free(capture);
+
+  FILE *file = fopen(output, "rb");
+  char header[128];
+  size_t size = width * height * 3;
+  unsigned char *yuv = malloc(size);
+  bool read = file && yuv && !failed && fgets(header, sizeof(header), file) &&
+              fgets(header, sizeof(header), file) &&
+              (strcmp(header, "FRAME\n") == 0) &&
+              (fread(yuv, 1, size, file) == size);
+  if (file) {
+    fclose(file);
+  }
+  if (!read) {
+    free(yuv);
+    return -1;
+  }
+
+  // Luma is in the first plane, black being 16 and white 235
+  int differences = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int sx = x * HIRES_WIDTH / width;
+      int sy = y * HIRES_HEIGHT / height;
+      bool expected = (scale > 1) ? lit(ch8, sx, sy) :
+                      lit(ch8, sx, sy) || lit(ch8, sx + 1, sy) ||
+                      lit(ch8, sx, sy + 1) || lit(ch8, sx + 1, sy + 1);
+      differences += expected != (yuv[y * width + x] > 128);
+    }
+  }
+
+  free(yuv);
+  return differences;
+} /* check_scale() */
+
+/*
+ *  Whether a high resolution pixel is set on any plane.
+ */
+
+static bool lit(const ch8_t *ch8, int x, int y) {
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if ((ch8->gfx[p][y * 2 + x / 64] >> (63 - x % 64)) & 1) {
+      return true;
+    }
+  }
+  return false;
+} /* lit() */
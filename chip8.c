@@ -0,0 +1,1016 @@
+#include "chip8.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const unsigned char chip8_fontset[80] = {
+  0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+  0x20, 0x60, 0x20, 0x20, 0x70, // 1
+  0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+  0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+  0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+  0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+  0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+  0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+  0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+  0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+  0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+  0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+  0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+  0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+  0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+  0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+static const unsigned char schip_big_fontset[100] = {
+  0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+  0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+  0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+  0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+  0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+  0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+  0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+  0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+  0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C  // 9
+};
+
+/*
+ *  Finalizer from splitmix64, a cheap way to scatter the bits of a word.
+ */
+
+static inline uint64_t mix64(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/*
+ *  Hash term of a value at a position in the state. Zero values have a zero
+ *  term, so empty memory and an empty screen contribute nothing.
+ */
+
+static inline uint64_t hash_term(uint64_t pos, uint64_t value) {
+  uint64_t key = mix64(pos + 0x9E3779B97F4A7C15ULL);
+  return mix64(key ^ value) ^ mix64(key);
+}
+
+static unsigned char next_random(ch8_t *);
+static void skip_next(ch8_t *);
+static unsigned char frames_left(uint32_t, uint32_t);
+static void unknown_opcode(ch8_t *, unsigned short, unsigned short);
+static void raise_fault(ch8_t *, unsigned char, unsigned short);
+static void store_byte(ch8_t *, unsigned short, unsigned char);
+static uint64_t plane_hash(const ch8_t *, int);
+static void clear_screen(ch8_t *);
+static void set_resolution(ch8_t *, bool);
+static bool draw_sprite_row(ch8_t *, uint64_t *, int, int, unsigned int, int);
+static void scroll_down(ch8_t *, int);
+static void scroll_up(ch8_t *, int);
+static void scroll_right(ch8_t *);
+static void scroll_left(ch8_t *);
+
+/*
+ *  Allocates count machines on a cache line boundary, which their layout
+ *  relies on. Returns NULL if that fails, and they're freed with free().
+ */
+
+ch8_t *alloc_machines(size_t count) {
+  return aligned_alloc(CACHE_LINE, count * sizeof(ch8_t));
+} /* alloc_machines() */
+
+void initialize(ch8_t *ch8, uint32_t seed) {
+  *ch8 = (ch8_t) {0}; // Set everything to zero.
+
+  ch8->pc = ROM_START; // Program counter starts at where the rom is to be loaded.
+  ch8->I = 0;
+  ch8->sp = 0;
+  ch8->fault_policy = FAULT_REPORT;
+  ch8->planes = 0x1;
+  ch8->pitch = DEFAULT_PITCH;
+  ch8->rng = seed ? seed : DEFAULT_SEED; // Xorshift gets stuck at zero
+
+  // Square wave until a program loads its own pattern with F002
+  for (int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+    ch8->pattern[i] = (i % 2) ? 0x00 : 0xFF;
+  }
+
+  // Fontset loading
+  for (int i = 0; i < 80; i++) { // TODO: multigesture has pre-increment but seems like it should be post ??? 
+    ch8->memory[FONT_ADDR + i] = chip8_fontset[i];
+  }
+  memcpy(ch8->memory + BIG_FONT_ADDR, schip_big_fontset,
+         sizeof(schip_big_fontset));
+  state_rehash(ch8);
+} /* initialize() */
+
+/*
+ *  Loads rom of given rom name.
+ */
+
+bool load_rom(ch8_t *ch8, const char *rom_name) {
+  
+  FILE *rom = 0;
+  rom = fopen(rom_name, "rb");
+
+  if (!rom) {
+    return false;
+  }
+
+  fread(ch8->memory + ROM_START, ROM_MAX_SIZE, 1, rom);
+  fclose(rom);
+  state_rehash(ch8);
+
+  return true;
+} /* load_rom() */
+
+/*
+ *  Completes one cycle (reads in one opcode) of the emulation.
+ */
+
+void emulate_cycle(ch8_t *ch8, bool *draw_flag) {
+
+  // Faults are accumulated without branching and handled once at the end.
+  unsigned short pc = ch8->pc;
+  unsigned char fault = (pc == RAM_SIZE - 1) * FAULT_MEMORY_WRAP;
+
+  // Decoded into a local rather than stored in the machine
+  unsigned short opcode = ch8->memory[pc] << 8 | ch8->memory[pc + 1];
+
+  ch8->pc += 2; // Move to the next instruction.
+
+  switch(opcode & 0xF000) {
+    // Matched on the whole opcode, with the masks disasm.c uses, so 0NNN
+    // machine code calls are unknown rather than run as whatever their low
+    // byte looks like
+    case 0x0000:
+      if ((opcode & 0xFFF0) == 0x00C0) { // 0x00CN: Scroll down N lines
+        scroll_down(ch8, opcode & 0x000F);
+        *draw_flag = true;
+        break;
+      }
+
+      if ((opcode & 0xFFF0) == 0x00D0) { // 0x00DN: Scroll up N lines
+        scroll_up(ch8, opcode & 0x000F);
+        *draw_flag = true;
+        break;
+      }
+
+      switch(opcode) {
+        case 0x00E0: // 0x00E0: Clears the screen
+          clear_screen(ch8);
+          *draw_flag = true;
+          break;
+
+        case 0x00EE: // 0x00EE: Returns from subroutine
+          fault |= (ch8->sp == 0) * FAULT_STACK_UNDERFLOW;
+          ch8->sp = (ch8->sp - 1) & (STACK_SIZE - 1);
+          ch8->pc = ch8->stack[ch8->sp];
+          break;
+
+        case 0x00FB: // 0x00FB: Scroll right 4 pixels
+          scroll_right(ch8);
+          *draw_flag = true;
+          break;
+
+        case 0x00FC: // 0x00FC: Scroll left 4 pixels
+          scroll_left(ch8);
+          *draw_flag = true;
+          break;
+
+        case 0x00FD: // 0x00FD: Exit the interpreter
+          ch8->halted = true;
+          break;
+
+        case 0x00FE: // 0x00FE: Low resolution (64x32)
+          set_resolution(ch8, false);
+          *draw_flag = true;
+          break;
+
+        case 0x00FF: // 0x00FF: High resolution (128x64)
+          set_resolution(ch8, true);
+          *draw_flag = true;
+          break;
+
+        default:
+          unknown_opcode(ch8, pc, opcode);
+      }
+      break;
+
+    case 0x1000: // 0x1NNN: Jump, setting the PC to NNN
+      ch8->pc = opcode & 0x0FFF;
+      break;
+
+    case 0x2000: // 0x2NNN: Push PC to stack and then set PC to NNN
+      fault |= (ch8->sp >= STACK_SIZE) * FAULT_STACK_OVERFLOW;
+      ch8->stack[ch8->sp & (STACK_SIZE - 1)] = ch8->pc;
+      ch8->sp = (ch8->sp & (STACK_SIZE - 1)) + 1;
+      ch8->pc = opcode & 0x0FFF;
+      break;
+
+    case 0x3000: // 0x3XNN: Skip an instruction if VX is equal to NN
+      if (ch8->V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) {
+        skip_next(ch8);
+      }
+      break;
+
+    case 0x4000: // 0x4XNN Skip an instruction if VX is not equal to NN
+      if (ch8->V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) {
+        skip_next(ch8);
+      }
+      break;
+
+    case 0x5000: {
+      int x = (opcode & 0x0F00) >> 8;
+      int y = (opcode & 0x00F0) >> 4;
+      int step = (x <= y) ? 1 : -1;
+
+      switch (opcode & 0x000F) {
+        case 0x0000: // 0x5XY0: Skips an instruction if VX and VY are equal
+          if (ch8->V[x] == ch8->V[y]) {
+            skip_next(ch8);
+          }
+          break;
+
+        case 0x0002: // 0x5XY2: Store VX to VY in memory at I (XO-CHIP)
+          fault |= (ch8->I + abs(y - x) >= RAM_SIZE) * FAULT_MEMORY_WRAP;
+          for (int i = 0; i <= abs(y - x); i++) {
+            store_byte(ch8, ch8->I + i, ch8->V[x + i * step]);
+          }
+          break;
+
+        case 0x0003: // 0x5XY3: Load VX to VY from memory at I (XO-CHIP)
+          fault |= (ch8->I + abs(y - x) >= RAM_SIZE) * FAULT_MEMORY_WRAP;
+          for (int i = 0; i <= abs(y - x); i++) {
+            ch8->V[x + i * step] = ch8->memory[ch8->I + i];
+          }
+          break;
+
+        default:
+          unknown_opcode(ch8, pc, opcode);
+      }
+      break;
+    }
+
+    case 0x6000: // 0x6XNN: Set the register VX to NN
+      ch8->V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF; 
+      break;
+
+    case 0x7000: // 0x7XNN: Add NN to register VX 
+      ch8->V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF; 
+      break;
+
+    case 0x8000: {
+      // VF is written last, so it holds the flag even when it's VX.
+      unsigned char vx = ch8->V[(opcode & 0x0F00) >> 8];
+      unsigned char vy = ch8->V[(opcode & 0x00F0) >> 4];
+
+      switch(opcode & 0x000F) {
+        case 0x0000: // 0x8XY0: Set VX to VY
+          ch8->V[(opcode & 0x0F00) >> 8] =
+            ch8->V[(opcode & 0x00F0) >> 4];
+          break;
+
+        case 0x0001: // 0x8XY1: Set VX to binary or of VX and VY
+          ch8->V[(opcode & 0x0F00) >> 8] |=
+            ch8->V[(opcode & 0x00F0) >> 4];
+          break;
+
+        case 0x0002: // 0x8XY2: Set VX to binary and of VX and VY
+          ch8->V[(opcode & 0x0F00) >> 8] &=
+            ch8->V[(opcode & 0x00F0) >> 4];
+          break;
+
+        case 0x0003: // 0x8XY3: Set VX to binary xor of VX and VY
+          ch8->V[(opcode & 0x0F00) >> 8] ^=
+            ch8->V[(opcode & 0x00F0) >> 4];
+          break;
+
+        case 0x0004: // 0x8XY4: Set VX to VX plus VY, VF is the carry
+          ch8->V[(opcode & 0x0F00) >> 8] = vx + vy;
+          ch8->V[0xF] = (vx + vy) > 255;
+          break;
+
+        case 0x0005: // 0x8XY5: VX is VX - VY, VF is 0 on borrow
+          ch8->V[(opcode & 0x0F00) >> 8] = vx - vy;
+          ch8->V[0xF] = vx >= vy;
+          break;
+
+        case 0x0006: // 0x8XY6: Shift VX one bit to the right
+          ch8->V[(opcode & 0x0F00) >> 8] = vx >> 1;
+          ch8->V[0xF] = vx & 0x1;
+          break;
+
+        case 0x0007: // 0x8XY7: VX is VY - VX, VF is 0 on borrow
+          ch8->V[(opcode & 0x0F00) >> 8] = vy - vx;
+          ch8->V[0xF] = vy >= vx;
+          break;
+
+        case 0x000E: // 0x8XYE: Shift VX one bit to the left
+          ch8->V[(opcode & 0x0F00) >> 8] = vx << 1;
+          ch8->V[0xF] = vx >> 7;
+          break;
+
+        default:
+          unknown_opcode(ch8, pc, opcode);
+      }
+      break;
+    }
+
+    case 0x9000: // 0x9XY0: Skips an instruction if VX and VY are not equal
+      if (opcode & 0x000F) {
+        unknown_opcode(ch8, pc, opcode);
+      } else if (ch8->V[(opcode & 0x0F00) >> 8] !=
+                 ch8->V[(opcode & 0x00F0) >> 4]) {
+        skip_next(ch8);
+      }
+      break;
+
+    case 0xA000: // 0xANNN: Set index register ch8->I to NNN
+      ch8->I = opcode & 0x0FFF;
+      break;
+
+    case 0xB000: // 0xBNNN: Jump to NNN plus V0
+      ch8->pc = (opcode & 0x0FFF) + ch8->V[0];
+      break;
+
+    case 0xC000: // 0xCXNN: Generates random number
+      ch8->V[(opcode & 0x0F00) >> 8] = (next_random(ch8) &
+                                             (opcode & 0x00FF));
+      break;
+
+    case 0xD000: { // 0xDXYN: Draws sprites to screen, DXY0 is 16x16 (SCHIP)
+      int width = ch8->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+      int height = ch8->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+      int x = ch8->V[(opcode & 0x0F00) >> 8] % width;
+      int y = ch8->V[(opcode & 0x00F0) >> 4] % height;
+      int rows = opcode & 0x000F;
+      int sprite_width = 8;
+      int collisions = 0;
+
+      if (rows == 0) {
+        rows = 16;
+        sprite_width = 16;
+      }
+
+      // Each selected plane takes the next sprite from I, in plane order.
+      // Sprites are clipped at the bottom and right edges of the screen.
+      unsigned short sprite = ch8->I;
+      int sprite_bytes = rows * (sprite_width / 8);
+      int plane_count = (ch8->planes & 1) + ((ch8->planes >> 1) & 1);
+      fault |= (ch8->I + sprite_bytes * plane_count > RAM_SIZE) *
+               FAULT_MEMORY_WRAP;
+      for (int p = 0; p < GFX_PLANES; p++) {
+        if (!(ch8->planes & (1 << p))) {
+          continue;
+        }
+
+        for (int i = 0; (i < rows) && (y + i < height); i++) {
+          unsigned int bits = ch8->memory[sprite + i];
+          if (sprite_width == 16) {
+            bits = (ch8->memory[sprite + 2 * i] << 8) |
+                   ch8->memory[sprite + 2 * i + 1];
+          }
+          collisions += draw_sprite_row(ch8, ch8->gfx[p], x, y + i, bits,
+                                        sprite_width);
+        }
+        sprite += sprite_bytes;
+      }
+
+      // SCHIP reports the number of colliding rows in high resolution.
+      ch8->V[0xF] = ch8->hires ? collisions : (collisions > 0);
+      *draw_flag = true;
+      break;
+    }
+
+    case 0xE000: {
+      bool pressed = (ch8->keys >> (ch8->V[(opcode & 0x0F00) >> 8] &
+                                    0xF)) & 1;
+      switch(opcode & 0x00FF) {
+        case 0x009E: // 0xEX9E: Skip an instruction if key VX is pressed
+          if (pressed) {
+            skip_next(ch8);
+          }
+          break;
+        case 0x00A1: // 0xEXA1: Skip an instruction if key VX isn't pressed
+          if (!pressed) {
+            skip_next(ch8);
+          }
+          break;
+
+        default:
+          unknown_opcode(ch8, pc, opcode);
+      }
+      break;
+    }
+
+    case 0xF000: { //TODO: Label what each opcode does.
+      if (opcode == 0xF000) { // 0xF000 NNNN: Load a 16-bit address into I
+        ch8->I = ch8->memory[ch8->pc] << 8 | ch8->memory[ch8->pc + 1];
+        ch8->pc += 2;
+        break;
+      }
+
+      switch (opcode & 0x00FF) {
+        case 0x0001: // 0xFN01: Select the drawing planes in N (XO-CHIP)
+          ch8->planes = (opcode & 0x0F00) >> 8;
+          break;
+
+        case 0x0002: // 0xF002: Load the audio pattern from I (XO-CHIP)
+          if (opcode != 0xF002) {
+            unknown_opcode(ch8, pc, opcode);
+            break;
+          }
+          fault |= (ch8->I + AUDIO_PATTERN_SIZE > RAM_SIZE) * FAULT_MEMORY_WRAP;
+          memcpy(ch8->pattern, ch8->memory + ch8->I, AUDIO_PATTERN_SIZE);
+          break;
+
+        case 0x0007: // 0xFX07: VX becomes current value of timer
+          ch8->V[(opcode & 0x0F00) >> 8] = get_delay_timer(ch8);
+          break;
+
+        case 0x000A: // 0xFX0A: Wait for a key to be released, put it in VX
+          // The machine stops running instructions until set_keys() sees a
+          // release, rather than running this one over and over.
+          ch8->key_wait = true;
+          ch8->key_wait_reg = (opcode & 0x0F00) >> 8;
+          break;
+
+        case 0x0015: // 0xFX15: Sets delay timer to VX
+          set_delay_timer(ch8, ch8->V[(opcode & 0x0F00) >> 8]);
+          break;
+
+        case 0x0018: // 0xFX18: Sets sound timer to VX
+          set_sound_timer(ch8, ch8->V[(opcode & 0x0F00) >> 8]);
+          break;
+
+        case 0x001E: // 0xFX1E: Add VX to index register I
+          ch8->I += ch8->V[(opcode & 0x0F00) >> 8];
+          break;
+
+        case 0x0029: // 0xFX29: Point I at the small font sprite for VX
+          ch8->I = FONT_ADDR + (ch8->V[(opcode & 0x0F00) >> 8] & 0xF) * 5;
+          break;
+
+        case 0x0030: // 0xFX30: Point I at the big font sprite for VX (SCHIP)
+          ch8->I = BIG_FONT_ADDR + (ch8->V[(opcode & 0x0F00) >> 8] % 10) * 10;
+          break;
+
+        case 0x0033: { // 0xFX33: "Binary-coded decimal conversion"
+          unsigned char num = ch8->V[(opcode & 0x0F00) >> 8];
+          fault |= (ch8->I + 2 >= RAM_SIZE) * FAULT_MEMORY_WRAP;
+          store_byte(ch8, ch8->I, num / 100); // Get hundreds place
+          store_byte(ch8, ch8->I + 1, (num % 100) / 10); // Get tens place
+          store_byte(ch8, ch8->I + 2, num % 10); // Get ones place
+          break;
+        }
+
+        case 0x003A: // 0xFX3A: Set the audio playback pitch to VX (XO-CHIP)
+          ch8->pitch = ch8->V[(opcode & 0x0F00) >> 8];
+          break;
+
+        case 0x0055: // 0xFX55: Store V0 to VX in memory starting at I
+          fault |= (ch8->I + ((opcode & 0x0F00) >> 8) >= RAM_SIZE) *
+                   FAULT_MEMORY_WRAP;
+          for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) {
+            store_byte(ch8, ch8->I + i, ch8->V[i]);
+          }
+          break;
+
+        case 0x0065: // 0xFX65: Load V0 to VX from memory starting at I
+          fault |= (ch8->I + ((opcode & 0x0F00) >> 8) >= RAM_SIZE) *
+                   FAULT_MEMORY_WRAP;
+          for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) {
+            ch8->V[i] = ch8->memory[ch8->I + i];
+          }
+          break;
+
+        case 0x0075: // 0xFX75: Store V0 to VX in the user flags (SCHIP)
+          for (int i = 0; i <= ((opcode & 0x0700) >> 8); i++) {
+            ch8->rpl[i] = ch8->V[i];
+          }
+          break;
+
+        case 0x0085: // 0xFX85: Load V0 to VX from the user flags (SCHIP)
+          for (int i = 0; i <= ((opcode & 0x0700) >> 8); i++) {
+            ch8->V[i] = ch8->rpl[i];
+          }
+          break;
+
+        default:
+          unknown_opcode(ch8, pc, opcode);
+      }
+      break;
+    }
+
+    default:
+      unknown_opcode(ch8, pc, opcode);
+  }
+
+  if (fault) {
+    raise_fault(ch8, fault, pc);
+  }
+} /* emulateCycle() */
+
+/*
+ *  Runs one 60 Hz frame of emulated time: a batch of instructions followed by
+ *  a timer tick. Turbo mode runs these faster than real time, so the timers
+ *  stay in step with the instructions rather than the host clock.
+ */
+
+void run_frame(ch8_t *ch8, bool *draw_flag) {
+  int i = ch8->frame_cycle;
+
+  // Cleared on both paths: a stop left by step_cycle() would otherwise be
+  // reported after the frame, even with the debugger's hooks removed
+  ch8->stopped = STOP_NONE;
+
+  // The rest of a frame that parks in FX0A is skipped, though the timers
+  // still count down.
+  if (!ch8->breakpoints && !ch8->watchpoints) {
+    for (; (i < CYCLES_PER_FRAME) && !ch8->halted && !ch8->key_wait; i++) {
+      emulate_cycle(ch8, draw_flag);
+    }
+  } else {
+    // Debugger attached: the frame can stop part way and be resumed later.
+    for (; (i < CYCLES_PER_FRAME) && !ch8->halted && !ch8->key_wait; i++) {
+      if (ch8->breakpoints && ch8->breakpoints[ch8->pc]) {
+        ch8->stopped = STOP_BREAKPOINT;
+        ch8->frame_cycle = i;
+        return;
+      }
+
+      emulate_cycle(ch8, draw_flag);
+      if (ch8->stopped) {
+        ch8->frame_cycle = i + 1;
+        return;
+      }
+    }
+  }
+
+  ch8->frame_cycle = 0;
+  tick_timers(ch8);
+} /* run_frame() */
+
+/*
+ *  Runs a single instruction, ignoring breakpoints, and ticks the timers if
+ *  that completes a frame.
+ */
+
+void step_cycle(ch8_t *ch8, bool *draw_flag) {
+  if (!ch8->halted && !ch8->key_wait) {
+    emulate_cycle(ch8, draw_flag);
+  }
+
+  if (++ch8->frame_cycle >= CYCLES_PER_FRAME) {
+    ch8->frame_cycle = 0;
+    tick_timers(ch8);
+  }
+} /* step_cycle() */
+
+/*
+ *  Whether running more frames would change nothing but the clock, until
+ *  the keys change: the machine is halted, waiting in FX0A or jumping to
+ *  itself.
+ */
+
+bool machine_idle(const ch8_t *ch8) {
+  unsigned short opcode = ch8->memory[ch8->pc] << 8 |
+                          ch8->memory[ch8->pc + 1];
+
+  // Above 0x1000 a 1NNN can't reach its own address, only one 4 KB below
+  return ch8->halted || ch8->key_wait ||
+         (((opcode & 0xF000) == 0x1000) && ((opcode & 0x0FFF) == ch8->pc));
+} /* machine_idle() */
+
+/*
+ *  Advances the clock the timers count down on, called once per 60 Hz
+ *  frame. Only the sound timer is looked at, to beep while it runs.
+ */
+
+void tick_timers(ch8_t *ch8) {
+  if (get_sound_timer(ch8)) {
+    beep(ch8);
+  }
+  ch8->clock++;
+
+  // Once 2^32 - 255 frames have gone by, a timer that ran out would read as
+  // running again, so every 2^31 frames the ones that ran out are moved up
+  // to the clock
+  if ((ch8->clock & 0x7FFFFFFF) == 0) {
+    if (!get_delay_timer(ch8)) {
+      ch8->delay_until = ch8->clock;
+    }
+    if (!get_sound_timer(ch8)) {
+      ch8->sound_until = ch8->clock;
+    }
+  }
+} /* tick_timers() */
+
+/*
+ *  Hashes the visible framebuffer, so replays can check they reproduce a
+ *  recording.
+ */
+
+uint64_t gfx_hash(const ch8_t *ch8) {
+  return mix64(ch8->framebuffer_hash ^ ch8->hires);
+} /* gfx_hash() */
+
+/*
+ *  Returns a 64-bit hash of the whole machine state in constant time. Memory
+ *  and the framebuffer are too big to rehash each step, so their hashes are
+ *  kept up to date as they're written: each is the XOR of a term per byte (or
+ *  per framebuffer word) keyed by position, so a write only has to swap the
+ *  old value's term for the new one. The registers change every instruction
+ *  and are only a few words, so they're mixed in here instead.
+ */
+
+uint64_t state_hash(const ch8_t *ch8) {
+  uint64_t words[12] = {0};
+
+  memcpy(words, ch8->V, sizeof(ch8->V));
+  memcpy(words + 2, ch8->stack, sizeof(ch8->stack));
+  memcpy(words + 6, ch8->rpl, sizeof(ch8->rpl));
+  memcpy(words + 7, ch8->pattern, sizeof(ch8->pattern));
+  words[9] = ch8->I | (uint64_t) ch8->pc << 16 | (uint64_t) ch8->sp << 32 |
+             (uint64_t) get_delay_timer(ch8) << 48 |
+             (uint64_t) get_sound_timer(ch8) << 56;
+  words[10] = ch8->rng | (uint64_t) ch8->pitch << 32 |
+              (uint64_t) ch8->planes << 40 | (uint64_t) ch8->hires << 48 |
+              (uint64_t) ch8->halted << 49 | (uint64_t) ch8->key_wait << 50 |
+              (uint64_t) ch8->key_wait_reg << 52;
+  words[11] = get_keys(ch8);
+
+  uint64_t hash = ch8->memory_hash ^ mix64(ch8->framebuffer_hash);
+  for (int i = 0; i < 12; i++) {
+    hash = mix64(hash ^ words[i]);
+  }
+  return hash;
+} /* state_hash() */
+
+/*
+ *  Recomputes the memory and framebuffer hashes from scratch. Needed after
+ *  changing memory or the framebuffer from outside the core.
+ */
+
+void state_rehash(ch8_t *ch8) {
+  ch8->memory_hash = 0;
+  for (int i = 0; i < RAM_SIZE; i++) {
+    ch8->memory_hash ^= hash_term(i, ch8->memory[i]);
+  }
+
+  ch8->framebuffer_hash = 0;
+  for (int p = 0; p < GFX_PLANES; p++) {
+    ch8->framebuffer_hash ^= plane_hash(ch8, p);
+  }
+  mirror_guard(ch8);
+} /* state_rehash() */
+
+/*
+ *  Copies the start of memory into the guard bytes past its end. Done by
+ *  state_rehash(), and needed on its own after restoring memory along with
+ *  its hashes.
+ */
+
+void mirror_guard(ch8_t *ch8) {
+  memcpy(ch8->memory + RAM_SIZE, ch8->memory, MEMORY_GUARD);
+} /* mirror_guard() */
+
+/*
+ *  Describes the lowest fault bit set.
+ */
+
+const char *fault_string(unsigned char faults) {
+  if (faults & FAULT_STACK_OVERFLOW) {
+    return "stack overflow";
+  } else if (faults & FAULT_STACK_UNDERFLOW) {
+    return "stack underflow";
+  } else if (faults & FAULT_MEMORY_WRAP) {
+    return "memory access past end of address space";
+  }
+  return "no fault";
+} /* fault_string() */
+
+/*
+ *  Returns the keypad state as a 16-bit mask, bit N being key N.
+ */
+
+uint16_t get_keys(const ch8_t *ch8) {
+  return ch8->keys;
+} /* get_keys() */
+
+/*
+ *  Sets the keypad state from a 16-bit mask. A key released while FX0A is
+ *  waiting completes it, the lowest one if several are released at once.
+ */
+
+void set_keys(ch8_t *ch8, uint16_t keys) {
+  uint16_t released = ch8->keys & ~keys;
+
+  if (ch8->key_wait && released) {
+    unsigned char key = 0;
+    while (!((released >> key) & 1)) {
+      key++;
+    }
+    ch8->V[ch8->key_wait_reg] = key;
+    ch8->key_wait = false;
+  }
+  ch8->keys = keys;
+} /* set_keys() */
+
+/*
+ *  Returns the delay timer's current value, the frames left until it
+ *  reaches zero.
+ */
+
+unsigned char get_delay_timer(const ch8_t *ch8) {
+  return frames_left(ch8->delay_until, ch8->clock);
+} /* get_delay_timer() */
+
+/*
+ *  Returns the sound timer's current value, non-zero while the tone plays.
+ */
+
+unsigned char get_sound_timer(const ch8_t *ch8) {
+  return frames_left(ch8->sound_until, ch8->clock);
+} /* get_sound_timer() */
+
+/*
+ *  Sets the delay timer to count down from value.
+ */
+
+void set_delay_timer(ch8_t *ch8, unsigned char value) {
+  ch8->delay_until = ch8->clock + value;
+} /* set_delay_timer() */
+
+/*
+ *  Sets the sound timer to count down from value.
+ */
+
+void set_sound_timer(ch8_t *ch8, unsigned char value) {
+  ch8->sound_until = ch8->clock + value;
+} /* set_sound_timer() */
+
+/*
+ *  Steps the machine's own xorshift generator, so a run depends only on the
+ *  seed it was initialized with.
+ */
+
+static unsigned char next_random(ch8_t *ch8) {
+  ch8->rng ^= ch8->rng << 13;
+  ch8->rng ^= ch8->rng >> 17;
+  ch8->rng ^= ch8->rng << 5;
+  return ch8->rng >> 24;
+} /* next_random() */
+
+/*
+ *  Stores a byte to memory, marking its page dirty for copy-on-write clones
+ *  and updating the memory hash. Only a few instructions store to memory, so
+ *  this keeps the rest of the core free of that bookkeeping.
+ */
+
+static void store_byte(ch8_t *ch8, unsigned short addr, unsigned char value) {
+  int page = addr >> PAGE_SHIFT;
+
+  ch8->dirty[page / 64] |= 1ULL << (page % 64);
+  ch8->memory_hash ^= hash_term(addr, ch8->memory[addr]) ^
+                      hash_term(addr, value);
+  ch8->memory[addr] = value;
+  if (addr < MEMORY_GUARD) {
+    ch8->memory[RAM_SIZE + addr] = value;
+  }
+
+  if (ch8->watchpoints && ch8->watchpoints[addr]) {
+    ch8->stopped = STOP_WATCHPOINT;
+    ch8->watch_addr = addr;
+  }
+} /* store_byte() */
+
+/*
+ *  Returns the XOR of the hash terms of a plane's words. Only the words the
+ *  resolution uses are hashed: the rest are zero, whose terms are zero, so
+ *  a low resolution scroll or clear costs LORES_WORDS terms rather than all
+ *  of them.
+ */
+
+static uint64_t plane_hash(const ch8_t *ch8, int p) {
+  int used = ch8->hires ? GFX_WORDS : LORES_WORDS;
+  uint64_t hash = 0;
+
+  for (int i = 0; i < used; i++) {
+    hash ^= hash_term(RAM_SIZE + p * GFX_WORDS + i, ch8->gfx[p][i]);
+  }
+  return hash;
+} /* plane_hash() */
+
+/*
+ *  Clears the framebuffer.
+ */
+
+static void clear_screen(ch8_t *ch8) {
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (ch8->planes & (1 << p)) {
+      ch8->framebuffer_hash ^= plane_hash(ch8, p);
+      memset(ch8->gfx[p], 0, sizeof(ch8->gfx[p]));
+    }
+  }
+} /* clear_screen() */
+
+/*
+ *  Switches between the 64x32 and 128x64 modes, clearing every plane since the
+ *  row layout of the packed framebuffer changes with it.
+ */
+
+static void set_resolution(ch8_t *ch8, bool hires) {
+  ch8->hires = hires;
+  memset(ch8->gfx, 0, sizeof(ch8->gfx));
+  ch8->framebuffer_hash = 0;
+} /* set_resolution() */
+
+/*
+ *  Applies the fault policy to the faults raised by the instruction at pc.
+ */
+
+static void raise_fault(ch8_t *ch8, unsigned char fault, unsigned short pc) {
+  if (ch8->fault_policy == FAULT_WRAP) {
+    return;
+  }
+
+  if (!ch8->faults) {
+    ch8->fault_pc = pc;
+  }
+  ch8->faults |= fault;
+
+  if (ch8->fault_policy == FAULT_HALT) {
+    ch8->halted = true;
+  }
+} /* raise_fault() */
+
+/*
+ *  Frames until a timer set to reach zero at until does, given the clock.
+ */
+
+static unsigned char frames_left(uint32_t until, uint32_t clock) {
+  // Wrap-safe: a timer that ran out in the last 2^31 frames is behind the
+  // clock, see tick_timers(), and one that's running is never more than 255
+  // frames ahead
+  int32_t left = (int32_t) (until - clock);
+  return ((left > 0) && (left <= UINT8_MAX)) ? left : 0;
+} /* frames_left() */
+
+/*
+ *  Logs an opcode the core doesn't implement.
+ */
+
+static void unknown_opcode(ch8_t *ch8, unsigned short pc,
+                           unsigned short opcode) {
+  if (ch8->log) {
+    log_event(ch8->log, LOG_UNKNOWN_OPCODE, pc, opcode, ch8->clock);
+  }
+} /* unknown_opcode() */
+
+/*
+ *  Skips the next instruction, which is four bytes long if it is F000 NNNN.
+ */
+
+static void skip_next(ch8_t *ch8) {
+  unsigned short next = ch8->memory[ch8->pc] << 8 | ch8->memory[ch8->pc + 1];
+  ch8->pc += (next == 0xF000) ? 4 : 2;
+} /* skip_next() */
+
+/*
+ *  XORs one sprite row of the given width (8 or 16 bits, MSB first) onto row y
+ *  of a plane at column x, a whole word at a time. Pixels past the right edge
+ *  are clipped. Returns true if any lit pixel was turned off.
+ */
+
+static bool draw_sprite_row(ch8_t *ch8, uint64_t *plane, int x, int y,
+                            unsigned int bits, int width) {
+  int words = ch8->hires ? 2 : 1;
+  uint64_t *row = plane + y * words;
+  uint64_t sprite = (uint64_t) bits << (64 - width);
+  bool collision = false;
+
+  for (int w = 0; w < words; w++) {
+    int offset = x - 64 * w;
+    uint64_t mask = 0;
+
+    if ((offset >= 0) && (offset < 64)) {
+      mask = sprite >> offset;
+    } else if ((offset < 0) && (offset > -64)) {
+      mask = sprite << -offset;
+    }
+
+    if (mask) {
+      int pos = RAM_SIZE + (row + w - ch8->gfx[0]);
+      collision |= (row[w] & mask) != 0;
+      ch8->framebuffer_hash ^= hash_term(pos, row[w]) ^
+                               hash_term(pos, row[w] ^ mask);
+      row[w] ^= mask;
+    }
+  }
+  return collision;
+} /* draw_sprite_row() */
+
+/*
+ *  Scrolls the selected planes down by n rows (00CN), moving whole packed rows.
+ */
+
+static void scroll_down(ch8_t *ch8, int n) {
+  int words = ch8->hires ? 2 : 1;
+  int height = ch8->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (ch8->planes & (1 << p)) {
+      ch8->framebuffer_hash ^= plane_hash(ch8, p);
+      memmove(ch8->gfx[p] + n * words, ch8->gfx[p],
+              (height - n) * words * sizeof(uint64_t));
+      memset(ch8->gfx[p], 0, n * words * sizeof(uint64_t));
+      ch8->framebuffer_hash ^= plane_hash(ch8, p);
+    }
+  }
+} /* scroll_down() */
+
+/*
+ *  Scrolls the selected planes up by n rows (00DN).
+ */
+
+static void scroll_up(ch8_t *ch8, int n) {
+  int words = ch8->hires ? 2 : 1;
+  int height = ch8->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (ch8->planes & (1 << p)) {
+      ch8->framebuffer_hash ^= plane_hash(ch8, p);
+      memmove(ch8->gfx[p], ch8->gfx[p] + n * words,
+              (height - n) * words * sizeof(uint64_t));
+      memset(ch8->gfx[p] + (height - n) * words, 0,
+             n * words * sizeof(uint64_t));
+      ch8->framebuffer_hash ^= plane_hash(ch8, p);
+    }
+  }
+} /* scroll_up() */
+
+/*
+ *  Scrolls the selected planes right by 4 pixels (00FB), shifting each row
+ *  across its words.
+ */
+
+static void scroll_right(ch8_t *ch8) {
+  int words = ch8->hires ? 2 : 1;
+  int height = ch8->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (!(ch8->planes & (1 << p))) {
+      continue;
+    }
+
+    ch8->framebuffer_hash ^= plane_hash(ch8, p);
+    for (int y = 0; y < height; y++) {
+      uint64_t *row = ch8->gfx[p] + y * words;
+      for (int w = words - 1; w > 0; w--) {
+        row[w] = (row[w] >> 4) | (row[w - 1] << 60);
+      }
+      row[0] >>= 4;
+    }
+    ch8->framebuffer_hash ^= plane_hash(ch8, p);
+  }
+} /* scroll_right() */
+
+/*
+ *  Scrolls the selected planes left by 4 pixels (00FC).
+ */
+
+static void scroll_left(ch8_t *ch8) {
+  int words = ch8->hires ? 2 : 1;
+  int height = ch8->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (!(ch8->planes & (1 << p))) {
+      continue;
+    }
+
+    ch8->framebuffer_hash ^= plane_hash(ch8, p);
+    for (int y = 0; y < height; y++) {
+      uint64_t *row = ch8->gfx[p] + y * words;
+      for (int w = 0; w < words - 1; w++) {
+        row[w] = (row[w] << 4) | (row[w + 1] >> 60);
+      }
+      row[words - 1] <<= 4;
+    }
+    ch8->framebuffer_hash ^= plane_hash(ch8, p);
+  }
+} /* scroll_left() */
+
+/*
+ *  Logs that the sound timer is running. The tone itself is up to the
+ *  frontend, which reads get_sound_timer().
+ */
+
+void beep(ch8_t *ch8) {
+  if (ch8->log) {
+    log_event(ch8->log, LOG_BEEP, 0, 0, ch8->clock);
+  }
+} /* beep() */
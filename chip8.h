@@ -0,0 +1,159 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAM_SIZE (0x10000) // XO-CHIP extends the address space to 64 KB
+
+#define DISPLAY_WIDTH (64)
+#define DISPLAY_HEIGHT (32)
+
+#define HIRES_WIDTH (128) // SCHIP high resolution mode (00FF)
+#define HIRES_HEIGHT (64)
+
+#define ROM_START (0x200) // Where roms are loaded and run from
+#define ROM_MAX_SIZE (RAM_SIZE - ROM_START)
+
+#define FONT_ADDR (0x000)
+#define BIG_FONT_ADDR (0x050) // SCHIP 8x10 digits, right after the small font
+
+/*
+ *  The framebuffer is packed one bit per pixel into 64-bit words, with the
+ *  most significant bit being the leftmost pixel. A row is one word in low
+ *  resolution and two words in high resolution, rows being laid out back to
+ *  back, so a low resolution frame only occupies the first 256 bytes.
+ */
+
+#define GFX_WORDS (HIRES_WIDTH * HIRES_HEIGHT / 64)
+#define LORES_WORDS (DISPLAY_WIDTH * DISPLAY_HEIGHT / 64)
+#define GFX_PLANES (2) // XO-CHIP bitplanes, giving 4 colors
+
+// Bytes past the end of memory that mirror its start, so reads that run off
+// the end (sprites, FX65 and the like) wrap around without masking each one
+#define MEMORY_GUARD (32)
+
+// Memory is tracked in pages for copy-on-write clones, see clone.h
+#define PAGE_SHIFT (8)
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define RAM_PAGES (RAM_SIZE / PAGE_SIZE)
+
+#define AUDIO_PATTERN_SIZE (16) // XO-CHIP 128 bit sample buffer
+#define DEFAULT_PITCH (64) // 4000 Hz playback rate
+
+#define STACK_SIZE (16)
+
+// Machines are laid out and allocated in 64-byte cache lines, see ch8_t and
+// alloc_machines()
+#define CACHE_LINE (64)
+
+#define CYCLES_PER_FRAME (10) // Instructions per 60 Hz frame
+#define DEFAULT_SEED (0x2545F491)
+
+/*
+ *  What happens when a program overflows or underflows the stack or accesses
+ *  memory past the end of the address space. The access always wraps around,
+ *  so the host's memory is never touched. FAULT_REPORT also records the fault
+ *  in faults (and the address of the first faulting instruction in fault_pc)
+ *  for the caller to look at, and FAULT_HALT additionally halts the machine.
+ */
+
+typedef enum fault_policy {
+  FAULT_WRAP,
+  FAULT_REPORT,
+  FAULT_HALT
+} fault_policy_t;
+
+#define FAULT_STACK_OVERFLOW (0x1)
+#define FAULT_STACK_UNDERFLOW (0x2)
+#define FAULT_MEMORY_WRAP (0x4)
+
+// Why run_frame() returned part way through a frame, see ch8_t.stopped
+typedef enum stop_reason {
+  STOP_NONE,
+  STOP_BREAKPOINT,
+  STOP_WATCHPOINT
+} stop_reason_t;
+
+struct log_ring;
+
+typedef struct chip_8 {
+  // First cache line: the registers, stack and timers, which nearly every
+  // instruction touches.
+  unsigned char V[16];
+  unsigned short stack[STACK_SIZE];
+  unsigned short I;
+  unsigned short pc;
+  unsigned short sp;
+  uint16_t keys; // Keypad mask, bit N being key N
+  // Timers count down at 60 Hz on the machine's own clock of frames run.
+  // Rather than ticking them, each holds the clock value it reaches zero at,
+  // and its current value is worked out when read, see get_delay_timer().
+  uint32_t delay_until;
+  uint32_t sound_until;
+
+  // Second cache line: the rest of the per-frame state
+  _Alignas(CACHE_LINE) uint32_t clock;
+  uint32_t rng; // CXNN generator state, seeded by initialize()
+  unsigned short frame_cycle; // Instructions run so far this frame
+  unsigned char planes; // Bitmask of the planes selected by FN01
+  bool hires;
+  bool halted; // Set by 00FD
+  bool key_wait; // FX0A is parked until a key is released, see set_keys()
+  unsigned char key_wait_reg; // The X of that FX0A
+  unsigned char pitch; // Set by FX3A
+  unsigned char fault_policy; // A fault_policy_t, FAULT_REPORT by default
+  unsigned char faults; // FAULT_* bits seen so far
+  unsigned short fault_pc;
+  uint64_t memory_hash; // Kept up to date by stores, see state_hash()
+  uint64_t framebuffer_hash; // Kept up to date by drawing
+  struct log_ring *log; // Where events are logged, NULL for nowhere, see log.h
+
+  // Debugger hooks, NULL unless a debugger has breakpoints or watchpoints set.
+  // Both are per address flags: run_frame() stops before running an address
+  // flagged in breakpoints, and after a store to one flagged in watchpoints.
+  const unsigned char *breakpoints;
+  const unsigned char *watchpoints;
+  unsigned char stopped; // A stop_reason_t, STOP_NONE unless run_frame()
+                         // returned early
+  unsigned short watch_addr; // Address of the store that stopped it
+
+  // Rarely used state
+  unsigned char rpl[8]; // SCHIP user flags, FX75/FX85
+  unsigned char pattern[AUDIO_PATTERN_SIZE]; // Loaded by F002
+  uint64_t dirty[RAM_PAGES / 64]; // Pages stored to since last cleared
+
+  // Line aligned, so each PAGE_SIZE page of memory is whole cache lines
+  _Alignas(CACHE_LINE) uint64_t gfx[GFX_PLANES][GFX_WORDS];
+  _Alignas(CACHE_LINE) unsigned char memory[RAM_SIZE + MEMORY_GUARD]; // Last,
+                                                // see CH8_STATE_SIZE
+} ch8_t;
+
+#define CH8_STATE_SIZE (offsetof(ch8_t, memory)) // Everything but memory
+
+_Static_assert(offsetof(ch8_t, clock) == CACHE_LINE,
+               "registers, stack and timers fill the first cache line");
+
+ch8_t *alloc_machines(size_t);
+void initialize(ch8_t *, uint32_t);
+bool load_rom(ch8_t *, const char *);
+void emulate_cycle(ch8_t *, bool *);
+void tick_timers(ch8_t *);
+void run_frame(ch8_t *, bool *);
+void step_cycle(ch8_t *, bool *);
+bool machine_idle(const ch8_t *);
+uint64_t gfx_hash(const ch8_t *);
+uint64_t state_hash(const ch8_t *);
+void state_rehash(ch8_t *);
+void mirror_guard(ch8_t *);
+const char *fault_string(unsigned char);
+uint16_t get_keys(const ch8_t *);
+void set_keys(ch8_t *, uint16_t);
+unsigned char get_delay_timer(const ch8_t *);
+unsigned char get_sound_timer(const ch8_t *);
+void set_delay_timer(ch8_t *, unsigned char);
+void set_sound_timer(ch8_t *, unsigned char);
+void beep(ch8_t *);
+
+#endif
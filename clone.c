@@ -0,0 +1,395 @@
+#include "clone.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool save_gfx(ch8_cow_t *, const ch8_t *);
+static void load_gfx(ch8_t *, const ch8_cow_t *);
+static void image_release(cow_image_t *);
+static void page_release(cow_page_t *);
+
+/*
+ *  Preallocates room for capacity clones.
+ */
+
+bool slab_init(ch8_slab_t *slab, int capacity) {
+  *slab = (ch8_slab_t) {0};
+
+  slab->machines = alloc_machines(capacity);
+  slab->free_list = malloc(capacity * sizeof(int));
+  if (!slab->machines || !slab->free_list) {
+    slab_free(slab);
+    return false;
+  }
+
+  slab->capacity = capacity;
+  for (int i = 0; i < capacity; i++) {
+    slab->free_list[i] = capacity - 1 - i;
+  }
+  slab->free_count = capacity;
+  return true;
+} /* slab_init() */
+
+/*
+ *  Frees the slab and every clone in it.
+ */
+
+void slab_free(ch8_slab_t *slab) {
+  free(slab->machines);
+  free(slab->free_list);
+  *slab = (ch8_slab_t) {0};
+} /* slab_free() */
+
+/*
+ *  Copies src into a free slot of the slab. Returns NULL if the slab is full.
+ */
+
+ch8_t *slab_clone(ch8_slab_t *slab, const ch8_t *src) {
+  if (slab->free_count == 0) {
+    return NULL;
+  }
+
+  ch8_t *clone = &slab->machines[slab->free_list[--slab->free_count]];
+  clone_machine(clone, src);
+  return clone;
+} /* slab_clone() */
+
+/*
+ *  Returns a clone's slot to the slab.
+ */
+
+void slab_release(ch8_slab_t *slab, ch8_t *clone) {
+  slab->free_list[slab->free_count++] = clone - slab->machines;
+} /* slab_release() */
+
+/*
+ *  Copies a whole machine.
+ */
+
+void clone_machine(ch8_t *dst, const ch8_t *src) {
+  memcpy(dst, src, sizeof(ch8_t));
+} /* clone_machine() */
+
+/*
+ *  Makes the root of a tree of copy-on-write clones from a machine, copying
+ *  its memory into a new shared image.
+ */
+
+bool cow_init(ch8_cow_t *cow, const ch8_t *src) {
+  *cow = (ch8_cow_t) {0};
+
+  cow->image = malloc(sizeof(cow_image_t));
+  if (!cow->image || !save_gfx(cow, src)) {
+    free(cow->image);
+    cow->image = NULL;
+    return false;
+  }
+
+  cow->image->refs = 1;
+  memcpy(cow->image->data, src->memory, RAM_SIZE);
+  memcpy(cow->state, src, COW_STATE_SIZE);
+  return true;
+} /* cow_init() */
+
+/*
+ *  Clones src into dst, sharing its image and pages. Returns false, leaving
+ *  dst empty, if its own list of pages or framebuffer couldn't be allocated.
+ */
+
+bool cow_clone(ch8_cow_t *dst, const ch8_cow_t *src) {
+  *dst = *src;
+  dst->pages = NULL;
+  dst->gfx_spill = NULL;
+
+  if (src->page_count) {
+    dst->pages = malloc(src->page_count * sizeof(cow_page_t *));
+    if (!dst->pages) {
+      *dst = (ch8_cow_t) {0};
+      return false;
+    }
+    memcpy(dst->pages, src->pages, src->page_count * sizeof(cow_page_t *));
+  }
+  if (src->gfx_spill) {
+    dst->gfx_spill = malloc(GFX_PLANES * sizeof(*src->gfx_spill));
+    if (!dst->gfx_spill) {
+      free(dst->pages);
+      *dst = (ch8_cow_t) {0};
+      return false;
+    }
+    memcpy(dst->gfx_spill, src->gfx_spill,
+           GFX_PLANES * sizeof(*src->gfx_spill));
+  }
+
+  dst->image->refs++;
+  for (int i = 0; i < dst->page_count; i++) {
+    dst->pages[i]->refs++;
+  }
+  return true;
+} /* cow_clone() */
+
+/*
+ *  Drops a clone's references, freeing what no other clone shares.
+ */
+
+void cow_release(ch8_cow_t *cow) {
+  for (int i = 0; i < cow->page_count; i++) {
+    page_release(cow->pages[i]);
+  }
+  free(cow->pages);
+  free(cow->gfx_spill);
+  image_release(cow->image);
+  *cow = (ch8_cow_t) {0};
+} /* cow_release() */
+
+/*
+ *  Bytes of memory a clone takes, counting an even share of the pages and
+ *  image it shares with other clones and workspaces.
+ */
+
+size_t cow_size(const ch8_cow_t *cow) {
+  size_t size = sizeof(*cow) + cow->page_count * sizeof(cow_page_t *);
+
+  if (cow->gfx_spill) {
+    size += GFX_PLANES * sizeof(*cow->gfx_spill);
+  }
+  for (int i = 0; i < cow->page_count; i++) {
+    size += sizeof(cow_page_t) / cow->pages[i]->refs;
+  }
+  if (cow->image) {
+    size += sizeof(cow_image_t) / cow->image->refs;
+  }
+  return size;
+} /* cow_size() */
+
+/*
+ *  Sets up an empty workspace.
+ */
+
+void cow_workspace_init(cow_workspace_t *work) {
+  memset(work, 0, sizeof(*work));
+} /* cow_workspace_init() */
+
+/*
+ *  Drops the workspace's references.
+ */
+
+void cow_workspace_free(cow_workspace_t *work) {
+  for (int i = 0; i < RAM_PAGES; i++) {
+    page_release(work->pages[i]);
+  }
+  image_release(work->image);
+  memset(work, 0, sizeof(*work));
+} /* cow_workspace_free() */
+
+/*
+ *  Materializes a clone into the workspace machine so it can be run.
+ */
+
+void cow_load(cow_workspace_t *work, const ch8_cow_t *cow) {
+  ch8_t *machine = &work->machine;
+  cow_page_t *pages[RAM_PAGES] = {0};
+
+  for (int i = 0; i < cow->page_count; i++) {
+    pages[cow->pages[i]->index] = cow->pages[i];
+  }
+
+  if (work->image != cow->image) {
+    cow_workspace_free(work);
+    work->image = cow->image;
+    work->image->refs++;
+    memcpy(machine->memory, cow->image->data, RAM_SIZE);
+  }
+
+  // Only rewrite the pages where the workspace differs from the clone: the
+  // ones stored to by the last run, or overridden by a different page.
+  for (int i = 0; i < RAM_PAGES; i++) {
+    bool dirty = (machine->dirty[i / 64] >> (i % 64)) & 1;
+
+    if (dirty || (work->pages[i] != pages[i])) {
+      const unsigned char *src = pages[i] ? pages[i]->data :
+                                 cow->image->data + i * PAGE_SIZE;
+      memcpy(machine->memory + i * PAGE_SIZE, src, PAGE_SIZE);
+    }
+
+    if (pages[i]) {
+      pages[i]->refs++;
+    }
+    page_release(work->pages[i]);
+    work->pages[i] = pages[i];
+  }
+
+  // Before the state, as what needs clearing depends on the old resolution
+  load_gfx(machine, cow);
+  memcpy(machine, cow->state, COW_STATE_SIZE);
+  memset(machine->dirty, 0, sizeof(machine->dirty));
+  mirror_guard(machine);
+} /* cow_load() */
+
+/*
+ *  Captures the workspace machine into a new clone in cow (which must be empty
+ *  or released), copying the pages stored to since it was loaded and sharing
+ *  everything else. The copied pages are also adopted by the workspace, so
+ *  saving again shares them. Returns false if anything couldn't be
+ *  allocated.
+ */
+
+bool cow_save(ch8_cow_t *cow, cow_workspace_t *work) {
+  ch8_t *machine = &work->machine;
+  int page_count = 0;
+
+  for (int i = 0; i < RAM_PAGES; i++) {
+    if (!((machine->dirty[i / 64] >> (i % 64)) & 1)) {
+      continue;
+    }
+
+    cow_page_t *page = malloc(sizeof(cow_page_t));
+    if (!page) {
+      return false;
+    }
+    page->refs = 1;
+    page->index = i;
+    memcpy(page->data, machine->memory + i * PAGE_SIZE, PAGE_SIZE);
+    page_release(work->pages[i]);
+    work->pages[i] = page;
+  }
+  memset(machine->dirty, 0, sizeof(machine->dirty));
+
+  for (int i = 0; i < RAM_PAGES; i++) {
+    page_count += work->pages[i] != NULL;
+  }
+
+  *cow = (ch8_cow_t) {0};
+  if (page_count) {
+    cow->pages = malloc(page_count * sizeof(cow_page_t *));
+    if (!cow->pages) {
+      return false;
+    }
+  }
+  if (!save_gfx(cow, machine)) {
+    free(cow->pages);
+    cow->pages = NULL;
+    return false;
+  }
+
+  memcpy(cow->state, machine, COW_STATE_SIZE);
+  cow->image = work->image;
+  cow->image->refs++;
+  for (int i = 0; i < RAM_PAGES; i++) {
+    if (work->pages[i]) {
+      cow->pages[cow->page_count++] = work->pages[i];
+      work->pages[i]->refs++;
+    }
+  }
+  return true;
+} /* cow_save() */
+
+/*
+ *  Starts a snapshot with a full copy of the machine.
+ */
+
+void snapshot_init(ch8_snapshot_t *snapshot, ch8_t *machine) {
+  memset(machine->dirty, 0, sizeof(machine->dirty));
+  memcpy(snapshot->memory, machine->memory, RAM_SIZE);
+  memcpy(snapshot->state, machine, CH8_STATE_SIZE);
+} /* snapshot_init() */
+
+/*
+ *  Saves the machine as it is now, copying only the pages written since the
+ *  last save or restore.
+ */
+
+void snapshot_save(ch8_snapshot_t *snapshot, ch8_t *machine) {
+  for (int i = 0; i < RAM_PAGES; i++) {
+    if ((machine->dirty[i / 64] >> (i % 64)) & 1) {
+      memcpy(snapshot->memory + i * PAGE_SIZE,
+             machine->memory + i * PAGE_SIZE, PAGE_SIZE);
+    }
+  }
+  memset(machine->dirty, 0, sizeof(machine->dirty));
+  memcpy(snapshot->state, machine, CH8_STATE_SIZE);
+} /* snapshot_save() */
+
+/*
+ *  Puts the machine back to the last save, copying back only the pages
+ *  written since. The saved state has no dirty pages, so neither does the
+ *  machine afterwards.
+ */
+
+void snapshot_restore(const ch8_snapshot_t *snapshot, ch8_t *machine) {
+  bool first_page = machine->dirty[0] & 1;
+
+  for (int i = 0; i < RAM_PAGES; i++) {
+    if ((machine->dirty[i / 64] >> (i % 64)) & 1) {
+      memcpy(machine->memory + i * PAGE_SIZE,
+             snapshot->memory + i * PAGE_SIZE, PAGE_SIZE);
+    }
+  }
+  memcpy(machine, snapshot->state, CH8_STATE_SIZE);
+
+  if (first_page) {
+    mirror_guard(machine);
+  }
+} /* snapshot_restore() */
+
+/*
+ *  Stores a machine's framebuffer in an empty clone: inline if it's only
+ *  plane 0 in low resolution, otherwise spilled whole. Returns false if the
+ *  spill couldn't be allocated.
+ */
+
+static bool save_gfx(ch8_cow_t *cow, const ch8_t *machine) {
+  bool spill = machine->hires;
+
+  // In low resolution only the first LORES_WORDS of each plane are drawn on
+  for (int p = 1; p < GFX_PLANES; p++) {
+    for (int i = 0; i < LORES_WORDS; i++) {
+      spill |= machine->gfx[p][i] != 0;
+    }
+  }
+
+  if (!spill) {
+    memcpy(cow->gfx, machine->gfx[0], sizeof(cow->gfx));
+    return true;
+  }
+
+  cow->gfx_spill = malloc(sizeof(machine->gfx));
+  if (!cow->gfx_spill) {
+    return false;
+  }
+  memcpy(cow->gfx_spill, machine->gfx, sizeof(machine->gfx));
+  return true;
+} /* save_gfx() */
+
+/*
+ *  Restores a clone's framebuffer into a machine that still has its old
+ *  state, clearing only as much of the old frame as its resolution used.
+ */
+
+static void load_gfx(ch8_t *machine, const ch8_cow_t *cow) {
+  if (cow->gfx_spill) {
+    memcpy(machine->gfx, cow->gfx_spill, sizeof(machine->gfx));
+    return;
+  }
+
+  size_t used = machine->hires ? sizeof(machine->gfx[0]) :
+                LORES_WORDS * sizeof(uint64_t);
+  for (int p = 1; p < GFX_PLANES; p++) {
+    memset(machine->gfx[p], 0, used);
+  }
+  memcpy(machine->gfx[0], cow->gfx, sizeof(cow->gfx));
+  if (machine->hires) {
+    memset(machine->gfx[0] + LORES_WORDS, 0, used - sizeof(cow->gfx));
+  }
+} /* load_gfx() */
+
+static void image_release(cow_image_t *image) {
+  if (image && (--image->refs == 0)) {
+    free(image);
+  }
+}
+
+static void page_release(cow_page_t *page) {
+  if (page && (--page->refs == 0)) {
+    free(page);
+  }
+}
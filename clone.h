@@ -0,0 +1,97 @@
+#ifndef CLONE_H
+#define CLONE_H
+
+#include "chip8.h"
+
+/*
+ *  Full clones: a slab of preallocated machines that clones are copied into,
+ *  so cloning is a single memcpy with no allocation.
+ */
+
+typedef struct ch8_slab {
+  ch8_t *machines;
+  int capacity;
+  int *free_list;
+  int free_count;
+} ch8_slab_t;
+
+bool slab_init(ch8_slab_t *, int);
+void slab_free(ch8_slab_t *);
+ch8_t *slab_clone(ch8_slab_t *, const ch8_t *);
+void slab_release(ch8_slab_t *, ch8_t *);
+void clone_machine(ch8_t *, const ch8_t *);
+
+/*
+ *  Copy-on-write clones. A clone keeps the machine state before memory, and
+ *  reads memory from a shared, reference counted image overridden by the
+ *  pages it has written to. Cloning only copies the state and takes
+ *  references, and a page is only copied when a store touches it.
+ *
+ *  Clones are kept dense so that a million of them fit in memory: the
+ *  state before gfx, the low resolution frame of plane 0 (the first 256
+ *  bytes of gfx, see chip8.h), and a list of just the pages overridden.
+ *  The rom and fonts live in the shared image. Only a clone in high
+ *  resolution or drawing on plane 1 spills its whole framebuffer to a
+ *  separate allocation.
+ *
+ *  Clones aren't run directly. cow_load() materializes one into a workspace
+ *  machine, restoring just the pages that differ when the workspace already
+ *  holds the same image, and cow_save() captures the workspace back into a
+ *  clone, copying only the pages the core marked dirty.
+ */
+
+#define COW_STATE_SIZE (offsetof(ch8_t, gfx)) // Everything before gfx
+
+typedef struct cow_image {
+  int refs;
+  unsigned char data[RAM_SIZE];
+} cow_image_t;
+
+typedef struct cow_page {
+  int refs;
+  unsigned short index; // Page of memory it overrides
+  unsigned char data[PAGE_SIZE];
+} cow_page_t;
+
+typedef struct ch8_cow {
+  uint64_t state[(COW_STATE_SIZE + 7) / 8]; // ch8_t up to gfx
+  uint64_t gfx[LORES_WORDS]; // Plane 0 unless spilled
+  uint64_t (*gfx_spill)[GFX_WORDS]; // All of gfx, NULL unless needed
+  cow_image_t *image;
+  cow_page_t **pages; // Pages overriding the image, by increasing index
+  unsigned short page_count;
+} ch8_cow_t;
+
+typedef struct cow_workspace {
+  ch8_t machine;
+  cow_image_t *image; // Image machine.memory was built from
+  cow_page_t *pages[RAM_PAGES]; // Pages applied over the image
+} cow_workspace_t;
+
+bool cow_init(ch8_cow_t *, const ch8_t *);
+bool cow_clone(ch8_cow_t *, const ch8_cow_t *);
+void cow_release(ch8_cow_t *);
+void cow_workspace_init(cow_workspace_t *);
+void cow_workspace_free(cow_workspace_t *);
+void cow_load(cow_workspace_t *, const ch8_cow_t *);
+bool cow_save(ch8_cow_t *, cow_workspace_t *);
+size_t cow_size(const ch8_cow_t *);
+
+/*
+ *  Snapshots for going back a few frames, as in run-ahead. The snapshot
+ *  keeps a backup of memory that is brought up to date from the pages the
+ *  core marked dirty, so saving and restoring cost the state before memory
+ *  plus the pages written since. The snapshot owns the machine's dirty
+ *  bits, so it can't be mixed with copy-on-write clones of the same machine.
+ */
+
+typedef struct ch8_snapshot {
+  uint64_t state[(CH8_STATE_SIZE + 7) / 8]; // ch8_t up to memory
+  unsigned char memory[RAM_SIZE];
+} ch8_snapshot_t;
+
+void snapshot_init(ch8_snapshot_t *, ch8_t *);
+void snapshot_save(ch8_snapshot_t *, ch8_t *);
+void snapshot_restore(const ch8_snapshot_t *, ch8_t *);
+
+#endif
@@ -0,0 +1,201 @@
+#include "debug.h"
+#include "disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CODE_CONTEXT (4) // Instructions listed before and after the pc
+
+static void show_help();
+static void show_memory(const ch8_t *, unsigned short, int);
+
+/*
+ *  Sets up a debugger with nothing set, not paused.
+ */
+
+void debug_init(debugger_t *debug) {
+  memset(debug, 0, sizeof(*debug));
+} /* debug_init() */
+
+/*
+ *  Hands the flag arrays to the machine if any are in use, or detaches them
+ *  so it runs at full speed. Call after changing breakpoints or watchpoints.
+ */
+
+void debug_attach(debugger_t *debug, ch8_t *ch8) {
+  ch8->breakpoints = debug->breakpoint_count ? debug->breakpoints : NULL;
+  ch8->watchpoints = debug->watchpoint_count ? debug->watchpoints : NULL;
+} /* debug_attach() */
+
+/*
+ *  Pauses after run_frame() stopped on a breakpoint or watchpoint and says
+ *  why.
+ */
+
+void debug_stopped(debugger_t *debug, const ch8_t *ch8) {
+  debug->paused = true;
+
+  // A store can trigger a watchpoint just before an address with a
+  // breakpoint, so the reason is what says which one it was
+  if (ch8->stopped == STOP_WATCHPOINT) {
+    printf("Watchpoint: store to 0x%03X = 0x%02X\n", ch8->watch_addr,
+           ch8->memory[ch8->watch_addr]);
+  } else {
+    printf("Breakpoint at 0x%03X\n", ch8->pc);
+  }
+  debug_show_code(ch8, ch8->pc, 0);
+} /* debug_stopped() */
+
+/*
+ *  Reads and runs one command from stdin while paused. Returns false when
+ *  the user asks to quit.
+ */
+
+bool debug_prompt(debugger_t *debug, ch8_t *ch8, bool *draw_flag) {
+  char line[128];
+  char command[16] = "";
+  unsigned int addr = 0;
+  int count = 0;
+
+  printf("(chip8) ");
+  fflush(stdout);
+  if (!fgets(line, sizeof(line), stdin)) {
+    return false;
+  }
+
+  int args = sscanf(line, "%15s %x %d", command, &addr, &count);
+
+  switch (command[0]) {
+    case 'c': // Continue, stepping off a breakpoint first
+      step_cycle(ch8, draw_flag);
+      debug->paused = false;
+      break;
+
+    case 's': { // Step one or more instructions
+      int steps = 1;
+      sscanf(line, "%*s %d", &steps);
+      for (int i = 0; i < steps; i++) {
+        step_cycle(ch8, draw_flag);
+      }
+      debug_show_code(ch8, ch8->pc, 0);
+      break;
+    }
+
+    case 'b': // Toggle a breakpoint
+      if (args > 1) {
+        addr %= RAM_SIZE;
+        debug->breakpoints[addr] = !debug->breakpoints[addr];
+        debug->breakpoint_count += debug->breakpoints[addr] ? 1 : -1;
+        printf("Breakpoint at 0x%03X %s\n", addr,
+               debug->breakpoints[addr] ? "set" : "cleared");
+      }
+      break;
+
+    case 'w': // Toggle a range of watchpoints
+      if (args > 1) {
+        for (int i = 0; i < (args > 2 ? count : 1); i++) {
+          unsigned int a = (addr + i) % RAM_SIZE;
+          debug->watchpoints[a] = !debug->watchpoints[a];
+          debug->watchpoint_count += debug->watchpoints[a] ? 1 : -1;
+        }
+        printf("Watchpoints toggled from 0x%03X\n", addr);
+      }
+      break;
+
+    case 'd': // Delete everything
+      memset(debug->breakpoints, 0, sizeof(debug->breakpoints));
+      memset(debug->watchpoints, 0, sizeof(debug->watchpoints));
+      debug->breakpoint_count = 0;
+      debug->watchpoint_count = 0;
+      break;
+
+    case 'r':
+      debug_show_registers(ch8);
+      break;
+
+    case 'l':
+      debug_show_code(ch8, args > 1 ? addr : ch8->pc, CODE_CONTEXT);
+      break;
+
+    case 'x':
+      show_memory(ch8, args > 1 ? addr : ch8->I, args > 2 ? count : 16);
+      break;
+
+    case 'q':
+      return false;
+
+    case '\0':
+      break;
+
+    default:
+      show_help();
+  }
+
+  debug_attach(debug, ch8);
+  return true;
+} /* debug_prompt() */
+
+/*
+ *  Prints the registers, timers and stack.
+ */
+
+void debug_show_registers(const ch8_t *ch8) {
+  for (int i = 0; i < 16; i++) {
+    printf("V%X=%02X%s", i, ch8->V[i], (i % 8 == 7) ? "\n" : " ");
+  }
+  printf("I=%04X PC=%04X SP=%X DT=%02X ST=%02X%s%s\n", ch8->I, ch8->pc,
+         ch8->sp, get_delay_timer(ch8), get_sound_timer(ch8),
+         ch8->hires ? " hires" : "", ch8->halted ? " halted" : "");
+
+  printf("Stack:");
+  for (int i = 0; i < ch8->sp && i < STACK_SIZE; i++) {
+    printf(" %04X", ch8->stack[i]);
+  }
+  printf("\n");
+} /* debug_show_registers() */
+
+/*
+ *  Disassembles around addr, context instructions either side of it. Going
+ *  backwards assumes 2 byte instructions, so it can be off after F000 NNNN.
+ */
+
+void debug_show_code(const ch8_t *ch8, unsigned short addr, int context) {
+  unsigned short start = addr - 2 * context;
+
+  for (int i = 0; i <= 2 * context; i++) {
+    char text[32];
+    int len = disassemble(ch8->memory + start, text, sizeof(text));
+
+    printf("%s%04X: %02X%02X  %s%s\n", start == ch8->pc ? "=> " : "   ",
+           start, ch8->memory[start], ch8->memory[start + 1], text,
+           ch8->breakpoints && ch8->breakpoints[start] ? "  [break]" : "");
+    start += len;
+  }
+} /* debug_show_code() */
+
+/*
+ *  Hex dumps count bytes of memory from addr.
+ */
+
+static void show_memory(const ch8_t *ch8, unsigned short addr, int count) {
+  for (int i = 0; i < count; i++) {
+    if (i % 16 == 0) {
+      printf("%s%04X:", i ? "\n" : "", (addr + i) % RAM_SIZE);
+    }
+    printf(" %02X", ch8->memory[(addr + i) % RAM_SIZE]);
+  }
+  printf("\n");
+} /* show_memory() */
+
+static void show_help() {
+  printf("c            continue\n"
+         "s [n]        step n instructions\n"
+         "b ADDR       toggle breakpoint\n"
+         "w ADDR [n]   toggle watchpoints on n bytes\n"
+         "d            delete all breakpoints and watchpoints\n"
+         "r            show registers\n"
+         "l [ADDR]     list code around pc or ADDR\n"
+         "x [ADDR] [n] dump n bytes of memory from I or ADDR\n"
+         "q            quit\n");
+}
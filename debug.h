@@ -0,0 +1,27 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include "chip8.h"
+
+/*
+ *  Console debugger. The flag arrays are only handed to the machine while
+ *  at least one breakpoint or watchpoint is set, so a machine without any
+ *  runs the normal, unchecked run_frame() loop.
+ */
+
+typedef struct debugger {
+  bool paused;
+  int breakpoint_count;
+  int watchpoint_count;
+  unsigned char breakpoints[RAM_SIZE];
+  unsigned char watchpoints[RAM_SIZE];
+} debugger_t;
+
+void debug_init(debugger_t *);
+void debug_attach(debugger_t *, ch8_t *);
+void debug_stopped(debugger_t *, const ch8_t *);
+bool debug_prompt(debugger_t *, ch8_t *, bool *);
+void debug_show_registers(const ch8_t *);
+void debug_show_code(const ch8_t *, unsigned short, int);
+
+#endif
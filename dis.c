@@ -0,0 +1,239 @@
+#include "chip8.h"
+#include "disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *  chip8-dis: disassembles a rom with static control flow analysis.
+ *
+ *  Code is found by following every path from 0x200: jumps, calls, both
+ *  outcomes of skips, and fallthrough. Whatever isn't reached is listed as
+ *  data. Basic blocks start at entry points, branch targets and after
+ *  skips; calls and jumps get labels, and ANNN targets get data labels.
+ *  BNNN targets can't be resolved statically, so only NNN itself is
+ *  followed.
+ *
+ *  Usage: chip8-dis [-g] rom.ch8
+ *    -g  also print the basic blocks and the call graph
+ */
+
+static unsigned char memory[RAM_SIZE + 4];
+static unsigned char flags[RAM_SIZE];
+
+static void label(unsigned short, char *, size_t);
+static void print_listing(size_t);
+static void print_graph(size_t);
+
+int main(int argc, char *argv[]) {
+  bool graph = false;
+  const char *rom_name = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-g") == 0) {
+      graph = true;
+    } else {
+      rom_name = argv[i];
+    }
+  }
+
+  if (!rom_name) {
+    fprintf(stderr, "Usage: %s [-g] rom.ch8\n", argv[0]);
+    return 1;
+  }
+
+  FILE *rom = fopen(rom_name, "rb");
+  if (!rom) {
+    fprintf(stderr, "Can't open %s\n", rom_name);
+    return 1;
+  }
+  size_t rom_size = fread(memory + ROM_START, 1, RAM_SIZE - ROM_START, rom);
+  fclose(rom);
+
+  if (!reach(memory, RAM_SIZE, ROM_START, flags)) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  print_listing(rom_size);
+  if (graph) {
+    print_graph(rom_size);
+  }
+  return 0;
+} /* main() */
+
+/*
+ *  Names addr after the strongest reason it has a label, or leaves buf empty.
+ */
+
+static void label(unsigned short addr, char *buf, size_t size) {
+  if (flags[addr] & REACH_CALL_TARGET) {
+    snprintf(buf, size, "sub_%03X", addr);
+  } else if (flags[addr] & REACH_JUMP_TARGET) {
+    snprintf(buf, size, "L_%03X", addr);
+  } else if ((flags[addr] & REACH_DATA_REF) && !(flags[addr] & REACH_CODE)) {
+    snprintf(buf, size, "data_%03X", addr);
+  } else {
+    buf[0] = '\0';
+  }
+} /* label() */
+
+/*
+ *  Prints the rom as code and data with labels substituted for addresses.
+ */
+
+static void print_listing(size_t rom_size) {
+  size_t end = ROM_START + rom_size;
+  size_t addr = ROM_START;
+
+  while (addr < end) {
+    char name[16];
+    label(addr, name, sizeof(name));
+    if (name[0]) {
+      printf("\n%s:\n", name);
+    }
+
+    if (flags[addr] & REACH_CODE) {
+      char text[48];
+      int len = disassemble(memory + addr, text, sizeof(text));
+      unsigned short opcode = memory[addr] << 8 | memory[addr + 1];
+      const opcode_format_t *decoded = decode(opcode);
+      char target[16];
+      char operand[8];
+
+      // Replace the address operand with its label, if it has one.
+      snprintf(operand, sizeof(operand), "0x%03X", opcode & 0x0FFF);
+      label(opcode & 0x0FFF, target, sizeof(target));
+      char *found = strstr(text, operand);
+      // Unknown opcodes are still marked as code, and print as a DW that
+      // can contain the operand text
+      if (found && target[0] && decoded && (decoded->flow != FLOW_NONE)) {
+        char rest[48];
+        strcpy(rest, found + strlen(operand));
+        snprintf(found, sizeof(text) - (found - text), "%s%s", target, rest);
+      }
+
+      printf("  %04zX: %-24s ; %02X%02X\n", addr, text, memory[addr],
+             memory[addr + 1]);
+      addr += len;
+      continue;
+    }
+
+    // Data runs up to 8 bytes a line, broken at the next code or label.
+    printf("  %04zX: DB", addr);
+    int count = 0;
+    do {
+      printf("%s0x%02X", count ? ", " : " ", memory[addr]);
+      addr++;
+      count++;
+    } while ((addr < end) && (count < 8) &&
+             !(flags[addr] & (REACH_CODE | REACH_CALL_TARGET |
+                              REACH_JUMP_TARGET | REACH_DATA_REF)));
+    printf("\n");
+  }
+} /* print_listing() */
+
+/*
+ *  Prints each basic block with its successors, then the call graph.
+ */
+
+static void print_graph(size_t rom_size) {
+  size_t end = ROM_START + rom_size;
+
+  printf("\n; Basic blocks\n");
+  for (size_t addr = ROM_START; addr < end; addr++) {
+    if (!((flags[addr] & REACH_LEADER) && (flags[addr] & REACH_CODE))) {
+      continue;
+    }
+
+    // Walk to the last instruction of the block.
+    size_t last = addr;
+    size_t next = addr;
+    do {
+      last = next;
+      next += ((memory[last] << 8 | memory[last + 1]) == 0xF000) ? 4 : 2;
+    } while ((next < end) && (flags[next] & REACH_CODE) &&
+             !(flags[next] & REACH_LEADER));
+
+    unsigned short opcode = memory[last] << 8 | memory[last + 1];
+    const opcode_format_t *decoded = decode(opcode);
+    printf("; block %04zX-%04zX ->", addr, last);
+    switch (decoded ? decoded->flow : FLOW_EXIT) {
+      case FLOW_JUMP:
+      case FLOW_JUMP_INDIRECT:
+        printf(" %04X%s", opcode & 0x0FFF,
+               decoded->flow == FLOW_JUMP_INDIRECT ? "+V0" : "");
+        break;
+      case FLOW_SKIP:
+        printf(" %04zX %04zX", next, next +
+               (((memory[next] << 8 | memory[next + 1]) == 0xF000) ? 4 : 2));
+        break;
+      case FLOW_CALL:
+        printf(" call %04X, %04zX", opcode & 0x0FFF, next);
+        break;
+      case FLOW_RETURN:
+        printf(" return");
+        break;
+      case FLOW_EXIT:
+        printf(" exit");
+        break;
+      default:
+        printf(" %04zX", next);
+    }
+    printf("\n");
+  }
+
+  printf("\n; Call graph\n");
+  static unsigned short stack[RAM_SIZE];
+  static unsigned char seen[RAM_SIZE];
+  static unsigned char called[RAM_SIZE];
+  for (size_t func = ROM_START; func < end; func++) {
+    if ((func != ROM_START) && !(flags[func] & REACH_CALL_TARGET)) {
+      continue;
+    }
+
+    // The body is everything reachable from the entry without entering
+    // calls; each call found in it is an edge.
+    memset(seen, 0, sizeof(seen));
+    memset(called, 0, sizeof(called));
+    int depth = 0;
+    stack[depth++] = func;
+    printf("; %s_%03zX:", func == ROM_START ? "start" : "sub", func);
+    while (depth > 0) {
+      unsigned short addr = stack[--depth];
+      if ((addr >= RAM_SIZE - 1) || seen[addr] || !(flags[addr] & REACH_CODE)) {
+        continue;
+      }
+      seen[addr] = 1;
+
+      unsigned short opcode = memory[addr] << 8 | memory[addr + 1];
+      const opcode_format_t *decoded = decode(opcode);
+      unsigned short next = addr + ((opcode == 0xF000) ? 4 : 2);
+      switch (decoded ? decoded->flow : FLOW_EXIT) {
+        case FLOW_JUMP:
+        case FLOW_JUMP_INDIRECT:
+          stack[depth++] = opcode & 0x0FFF;
+          break;
+        case FLOW_CALL:
+          if (!called[opcode & 0x0FFF]) {
+            called[opcode & 0x0FFF] = 1;
+            printf(" sub_%03X", opcode & 0x0FFF);
+          }
+          stack[depth++] = next;
+          break;
+        case FLOW_SKIP:
+          stack[depth++] = next;
+          stack[depth++] = next +
+            (((memory[next] << 8 | memory[next + 1]) == 0xF000) ? 4 : 2);
+          break;
+        case FLOW_RETURN:
+        case FLOW_EXIT:
+          break;
+        default:
+          stack[depth++] = next;
+      }
+    }
+    printf("\n");
+  }
+} /* print_graph() */
@@ -0,0 +1,264 @@
+#include "disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *  Instruction formats, matched in order against (opcode & mask) == match.
+ *  In the format, %X and %Y are the register nibbles, %N the low nibble, %B
+ *  the low byte, %A the 12-bit address and %L the word following F000.
+ *  These follow the cases of emulate_cycle() with the same masks, and
+ *  anything not listed here is an unknown opcode there too. chip8-test runs
+ *  every opcode through both to keep them that way.
+ */
+
+typedef struct walk {
+  const unsigned char *memory;
+  size_t size;
+  unsigned short start;
+  unsigned char *flags;
+  unsigned short *worklist;
+  size_t work_count;
+} walk_t;
+
+static void walk_path(walk_t *, unsigned short);
+static void walk_push(walk_t *, unsigned short, unsigned char);
+static unsigned short walk_fetch(const walk_t *, size_t);
+
+static const opcode_format_t formats[] = {
+  { 0xFFFF, 0x00E0, "CLS", FLOW_NONE },
+  { 0xFFFF, 0x00EE, "RET", FLOW_RETURN },
+  { 0xFFF0, 0x00C0, "SCD %N", FLOW_NONE },
+  { 0xFFF0, 0x00D0, "SCU %N", FLOW_NONE },
+  { 0xFFFF, 0x00FB, "SCR", FLOW_NONE },
+  { 0xFFFF, 0x00FC, "SCL", FLOW_NONE },
+  { 0xFFFF, 0x00FD, "EXIT", FLOW_EXIT },
+  { 0xFFFF, 0x00FE, "LOW", FLOW_NONE },
+  { 0xFFFF, 0x00FF, "HIGH", FLOW_NONE },
+  { 0xF000, 0x1000, "JP %A", FLOW_JUMP },
+  { 0xF000, 0x2000, "CALL %A", FLOW_CALL },
+  { 0xF000, 0x3000, "SE V%X, %B", FLOW_SKIP },
+  { 0xF000, 0x4000, "SNE V%X, %B", FLOW_SKIP },
+  { 0xF00F, 0x5000, "SE V%X, V%Y", FLOW_SKIP },
+  { 0xF00F, 0x5002, "SAVE V%X-V%Y", FLOW_NONE },
+  { 0xF00F, 0x5003, "LOAD V%X-V%Y", FLOW_NONE },
+  { 0xF000, 0x6000, "LD V%X, %B", FLOW_NONE },
+  { 0xF000, 0x7000, "ADD V%X, %B", FLOW_NONE },
+  { 0xF00F, 0x8000, "LD V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x8001, "OR V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x8002, "AND V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x8003, "XOR V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x8004, "ADD V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x8005, "SUB V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x8006, "SHR V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x8007, "SUBN V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x800E, "SHL V%X, V%Y", FLOW_NONE },
+  { 0xF00F, 0x9000, "SNE V%X, V%Y", FLOW_SKIP },
+  { 0xF000, 0xA000, "LD I, %A", FLOW_LOAD_I },
+  { 0xF000, 0xB000, "JP V0, %A", FLOW_JUMP_INDIRECT },
+  { 0xF000, 0xC000, "RND V%X, %B", FLOW_NONE },
+  { 0xF000, 0xD000, "DRW V%X, V%Y, %N", FLOW_NONE },
+  { 0xF0FF, 0xE09E, "SKP V%X", FLOW_SKIP },
+  { 0xF0FF, 0xE0A1, "SKNP V%X", FLOW_SKIP },
+  { 0xFFFF, 0xF000, "LD I, %L", FLOW_LOAD_I },
+  { 0xF0FF, 0xF001, "PLANE %X", FLOW_NONE },
+  { 0xFFFF, 0xF002, "AUDIO", FLOW_NONE },
+  { 0xF0FF, 0xF007, "LD V%X, DT", FLOW_NONE },
+  { 0xF0FF, 0xF00A, "LD V%X, K", FLOW_NONE },
+  { 0xF0FF, 0xF015, "LD DT, V%X", FLOW_NONE },
+  { 0xF0FF, 0xF018, "LD ST, V%X", FLOW_NONE },
+  { 0xF0FF, 0xF01E, "ADD I, V%X", FLOW_NONE },
+  { 0xF0FF, 0xF029, "LD F, V%X", FLOW_NONE },
+  { 0xF0FF, 0xF030, "LD HF, V%X", FLOW_NONE },
+  { 0xF0FF, 0xF033, "LD B, V%X", FLOW_NONE },
+  { 0xF0FF, 0xF03A, "PITCH V%X", FLOW_NONE },
+  { 0xF0FF, 0xF055, "LD [I], V%X", FLOW_NONE },
+  { 0xF0FF, 0xF065, "LD V%X, [I]", FLOW_NONE },
+  { 0xF0FF, 0xF075, "LD R, V%X", FLOW_NONE },
+  { 0xF0FF, 0xF085, "LD V%X, R", FLOW_NONE },
+};
+
+/*
+ *  Looks up the format of an opcode, NULL if it's unknown.
+ */
+
+const opcode_format_t *decode(unsigned short opcode) {
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    if ((opcode & formats[i].mask) == formats[i].match) {
+      return &formats[i];
+    }
+  }
+  return NULL;
+} /* decode() */
+
+/*
+ *  Returns the index'th format in the table, NULL past the end. The
+ *  assembler matches source lines against these in the same order.
+ */
+
+const opcode_format_t *opcode_format(size_t index) {
+  if (index >= sizeof(formats) / sizeof(formats[0])) {
+    return NULL;
+  }
+  return &formats[index];
+} /* opcode_format() */
+
+/*
+ *  Writes the mnemonic for the instruction at code into buf. Returns the
+ *  instruction's length in bytes, 4 for F000 NNNN and 2 otherwise. Unknown
+ *  opcodes come out as a data word.
+ */
+
+int disassemble(const unsigned char *code, char *buf, size_t size) {
+  unsigned short opcode = code[0] << 8 | code[1];
+  const opcode_format_t *decoded = decode(opcode);
+  const char *format = decoded ? decoded->format : NULL;
+  size_t len = 0;
+
+  if (!format) {
+    snprintf(buf, size, "DW 0x%04X", opcode);
+    return 2;
+  }
+
+  buf[0] = '\0';
+  for (const char *c = format; *c && (len + 8 < size); c++) {
+    if (*c != '%') {
+      buf[len++] = *c;
+      continue;
+    }
+
+    switch (*++c) {
+      case 'X':
+        len += sprintf(buf + len, "%X", (opcode & 0x0F00) >> 8);
+        break;
+      case 'Y':
+        len += sprintf(buf + len, "%X", (opcode & 0x00F0) >> 4);
+        break;
+      case 'N':
+        len += sprintf(buf + len, "%d", opcode & 0x000F);
+        break;
+      case 'B':
+        len += sprintf(buf + len, "0x%02X", opcode & 0x00FF);
+        break;
+      case 'A':
+        len += sprintf(buf + len, "0x%03X", opcode & 0x0FFF);
+        break;
+      case 'L':
+        len += sprintf(buf + len, "0x%04X", code[2] << 8 | code[3]);
+        break;
+    }
+  }
+  buf[len] = '\0';
+
+  return (opcode == 0xF000) ? 4 : 2;
+} /* disassemble() */
+
+/*
+ *  Finds the code reachable from start in size bytes of memory, following
+ *  jumps, calls, both outcomes of skips and fallthrough, and marks flags (one
+ *  per byte, zeroed by the caller) with REACH_* bits. BNNN targets can't be
+ *  resolved statically, so only NNN itself is followed, and paths end at
+ *  unknown opcodes and addresses below start. Returns false if there's no
+ *  memory for the worklist.
+ */
+
+bool reach(const unsigned char *memory, size_t size, unsigned short start,
+           unsigned char *flags) {
+  walk_t walk = { memory, size, start, flags, NULL, 0 };
+
+  walk.worklist = malloc(size * sizeof(unsigned short));
+  if (!walk.worklist) {
+    return false;
+  }
+
+  walk_push(&walk, start, REACH_LEADER);
+  while (walk.work_count > 0) {
+    walk_path(&walk, walk.worklist[--walk.work_count]);
+  }
+
+  free(walk.worklist);
+  return true;
+} /* reach() */
+
+/*
+ *  Follows straight line code from addr until it ends or reaches code that
+ *  has already been walked, queueing every other successor.
+ */
+
+static void walk_path(walk_t *walk, unsigned short addr) {
+  while ((addr >= walk->start) && ((size_t) addr + 1 < walk->size) &&
+         !(walk->flags[addr] & (REACH_CODE | REACH_CODE_TAIL))) {
+    unsigned short opcode = walk_fetch(walk, addr);
+    const opcode_format_t *decoded = decode(opcode);
+    int len = (opcode == 0xF000) ? 4 : 2;
+
+    walk->flags[addr] |= REACH_CODE;
+    for (int i = 1; (i < len) && ((size_t) addr + i < walk->size); i++) {
+      walk->flags[addr + i] |= REACH_CODE_TAIL;
+    }
+
+    unsigned short next = addr + len;
+    unsigned short target = opcode & 0x0FFF;
+    switch (decoded ? decoded->flow : FLOW_EXIT) {
+      case FLOW_JUMP:
+      case FLOW_JUMP_INDIRECT:
+        walk_push(walk, target, REACH_LEADER | REACH_JUMP_TARGET);
+        return;
+
+      case FLOW_CALL:
+        walk_push(walk, target, REACH_LEADER | REACH_CALL_TARGET);
+        walk_push(walk, next, REACH_LEADER);
+        return;
+
+      case FLOW_RETURN:
+      case FLOW_EXIT: // Unknown opcodes end the path too
+        return;
+
+      case FLOW_SKIP:
+        walk_push(walk, next, REACH_LEADER);
+        walk_push(walk, next + ((walk_fetch(walk, next) == 0xF000) ? 4 : 2),
+                  REACH_LEADER);
+        return;
+
+      case FLOW_LOAD_I:
+        if (opcode == 0xF000) {
+          target = walk_fetch(walk, addr + 2);
+        }
+        if (target < walk->size) {
+          walk->flags[target] |= REACH_DATA_REF;
+        }
+        break;
+
+      case FLOW_NONE:
+        break;
+    }
+    addr = next;
+  }
+} /* walk_path() */
+
+/*
+ *  Marks addr with the given flags and queues it to be walked.
+ */
+
+static void walk_push(walk_t *walk, unsigned short addr, unsigned char mark) {
+  if (addr >= walk->size) {
+    return;
+  }
+  walk->flags[addr] |= mark;
+  if (!(walk->flags[addr] & (REACH_CODE | REACH_CODE_TAIL)) &&
+      (walk->work_count < walk->size)) {
+    walk->worklist[walk->work_count++] = addr;
+  }
+} /* walk_push() */
+
+/*
+ *  Reads the big-endian word at addr, zero past the end of memory.
+ */
+
+static unsigned short walk_fetch(const walk_t *walk, size_t addr) {
+  if (addr + 1 >= walk->size) {
+    return 0;
+  }
+  return walk->memory[addr] << 8 | walk->memory[addr + 1];
+} /* walk_fetch() */
@@ -0,0 +1,39 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// How an instruction affects control flow, for static analysis
+typedef enum flow {
+  FLOW_NONE, // Falls through
+  FLOW_JUMP, // 1NNN
+  FLOW_CALL, // 2NNN, falls through on return
+  FLOW_RETURN, // 00EE
+  FLOW_EXIT, // 00FD
+  FLOW_SKIP, // Falls through or skips the next instruction
+  FLOW_JUMP_INDIRECT, // BNNN, target depends on V0
+  FLOW_LOAD_I // ANNN and F000 NNNN, NNN is likely data
+} flow_t;
+
+typedef struct opcode_format {
+  unsigned short mask;
+  unsigned short match;
+  const char *format;
+  flow_t flow;
+} opcode_format_t;
+
+// Per address marks left by reach()
+#define REACH_CODE (0x01) // First byte of an instruction
+#define REACH_CODE_TAIL (0x02) // Later byte of an instruction
+#define REACH_LEADER (0x04) // Starts a basic block
+#define REACH_JUMP_TARGET (0x08)
+#define REACH_CALL_TARGET (0x10)
+#define REACH_DATA_REF (0x20) // Loaded into I
+
+const opcode_format_t *decode(unsigned short);
+const opcode_format_t *opcode_format(size_t);
+int disassemble(const unsigned char *, char *, size_t);
+bool reach(const unsigned char *, size_t, unsigned short, unsigned char *);
+
+#endif
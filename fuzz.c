@@ -0,0 +1,292 @@
+#include "chip8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ *  Fuzzing harness for the core. Each input is a keypad script followed by a
+ *  rom image:
+ *
+ *    byte 0        number of key masks n
+ *    bytes 1..2n   key masks, little endian, one per frame (repeating)
+ *    the rest      rom, loaded at 0x200
+ *
+ *  Coverage is the AFL-style edge between consecutive program counters and
+ *  the opcode class run there, with an 8-bit hit counter per edge. Machines
+ *  run with FAULT_HALT, so stack overflows and underflows and accesses past
+ *  the end of memory stop the run and are reported as crashes; the sanitizers
+ *  catch anything the core doesn't guard.
+ *
+ *  Built with -DLIBFUZZER this only provides LLVMFuzzerTestOneInput(), and
+ *  libFuzzer drives it. Otherwise main() runs a small standalone mutational
+ *  fuzzer seeded from the roms given on the command line.
+ */
+
+#define FUZZ_FRAMES (120)
+#define COVERAGE_SIZE (1 << 16)
+#define MAX_INPUT (4096)
+#define MAX_CORPUS (1024)
+#define MAX_FAULTS (16)
+
+/*
+ *  Under libFuzzer the counters live in its extra counters section, so it
+ *  picks up the emulated program's edges alongside its own instrumentation of
+ *  the core, and clears them before each input.
+ */
+
+#ifdef LIBFUZZER
+__attribute__((used, section("__libfuzzer_extra_counters")))
+#endif
+unsigned char coverage[COVERAGE_SIZE];
+
+static const char *run_input(const uint8_t *, size_t);
+
+/*
+ *  libFuzzer entry point, aborting on a fault so it's saved as a crash.
+ */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  const char *fault = run_input(data, size);
+
+  if (fault) {
+    fprintf(stderr, "chip8 fault: %s\n", fault);
+    abort();
+  }
+  return 0;
+} /* LLVMFuzzerTestOneInput() */
+
+/*
+ *  Runs one input, returning a description of the first fault or NULL.
+ */
+
+static const char *run_input(const uint8_t *data, size_t size) {
+  static ch8_t ch8;
+  const uint8_t *keys = data + 1;
+  size_t key_count = size ? data[0] : 0;
+
+  if (size < 1 + 2 * key_count) {
+    return NULL;
+  }
+
+  size_t rom_size = size - 1 - 2 * key_count;
+  if (rom_size > ROM_MAX_SIZE) {
+    rom_size = ROM_MAX_SIZE;
+  }
+
+  initialize(&ch8, DEFAULT_SEED);
+  ch8.fault_policy = FAULT_HALT;
+  memcpy(ch8.memory + ROM_START, keys + 2 * key_count, rom_size);
+  state_rehash(&ch8);
+
+  unsigned short prev = 0;
+  bool draw_flag = false;
+
+  for (int frame = 0; (frame < FUZZ_FRAMES) && !ch8.halted; frame++) {
+    if (key_count) {
+      size_t k = frame % key_count;
+      set_keys(&ch8, keys[2 * k] | (keys[2 * k + 1] << 8));
+    }
+
+    for (int i = 0; (i < CYCLES_PER_FRAME) && !ch8.halted && !ch8.key_wait;
+         i++) {
+      unsigned short op = ch8.memory[ch8.pc] >> 4;
+      unsigned short edge = (prev >> 1) ^ ((ch8.pc << 4) | op);
+      coverage[edge % COVERAGE_SIZE]++;
+      prev = (ch8.pc << 4) | op;
+
+      emulate_cycle(&ch8, &draw_flag);
+    }
+    tick_timers(&ch8);
+  }
+  return ch8.faults ? fault_string(ch8.faults) : NULL;
+} /* run_input() */
+
+#ifndef LIBFUZZER
+
+static size_t mutate(uint8_t *, size_t);
+static unsigned char count_class(unsigned char);
+static bool new_coverage(unsigned char *);
+
+static uint8_t corpus[MAX_CORPUS][MAX_INPUT];
+static size_t corpus_size[MAX_CORPUS];
+static int corpus_count = 0;
+
+/*
+ *  Standalone fuzzer: chip8-fuzz [-n iterations] [-s seed] [roms...]
+ */
+
+int main(int argc, char *argv[]) {
+  long iterations = 100000;
+  unsigned int seed = time(0);
+  static unsigned char seen[COVERAGE_SIZE];
+  int crashes = 0;
+  const char *faults[MAX_FAULTS];
+  int fault_count = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      iterations = atol(argv[++i]);
+    } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      seed = strtoul(argv[++i], NULL, 0);
+    } else if (corpus_count < MAX_CORPUS) {
+      FILE *rom = fopen(argv[i], "rb");
+      if (!rom) {
+        fprintf(stderr, "Can't open %s\n", argv[i]);
+        continue;
+      }
+      corpus[corpus_count][0] = 0; // No key script
+      corpus_size[corpus_count] = 1 + fread(corpus[corpus_count] + 1, 1,
+                                            MAX_INPUT - 1, rom);
+      fclose(rom);
+      corpus_count++;
+    }
+  }
+
+  if (corpus_count == 0) {
+    corpus_size[corpus_count++] = 1;
+  }
+
+  srand(seed);
+  fprintf(stderr, "Fuzzing with seed %u\n", seed);
+
+  for (long it = 0; it < iterations; it++) {
+    static uint8_t input[MAX_INPUT];
+    int parent = rand() % corpus_count;
+    memcpy(input, corpus[parent], corpus_size[parent]);
+    size_t size = mutate(input, corpus_size[parent]);
+
+    memset(coverage, 0, sizeof(coverage));
+    const char *fault = run_input(input, size);
+
+    if (fault) {
+      // Only keep the first input for each kind of fault.
+      int kind = 0;
+      while ((kind < fault_count) && (faults[kind] != fault)) {
+        kind++;
+      }
+      crashes++;
+      if ((kind < fault_count) || (fault_count == MAX_FAULTS)) {
+        continue;
+      }
+      faults[fault_count++] = fault;
+
+      char name[64];
+      snprintf(name, sizeof(name), "crash-%u-%d.bin", seed, kind);
+      FILE *out = fopen(name, "wb");
+      if (out) {
+        fwrite(input, 1, size, out);
+        fclose(out);
+      }
+      fprintf(stderr, "#%ld fault: %s, saved %s\n", it, fault, name);
+    } else if (new_coverage(seen) && (corpus_count < MAX_CORPUS)) {
+      memcpy(corpus[corpus_count], input, size);
+      corpus_size[corpus_count++] = size;
+    }
+  }
+
+  int edges = 0;
+  for (int i = 0; i < COVERAGE_SIZE; i++) {
+    edges += seen[i] != 0;
+  }
+  fprintf(stderr, "Done: %d edges, %d corpus entries, %d crashes (%d kinds)\n",
+          edges, corpus_count, crashes, fault_count);
+  return crashes ? 1 : 0;
+} /* main() */
+
+/*
+ *  Applies a few random byte level mutations, returning the new size.
+ */
+
+static size_t mutate(uint8_t *data, size_t size) {
+  int count = 1 + rand() % 4;
+
+  for (int i = 0; i < count; i++) {
+    size_t pos = size > 1 ? 1 + rand() % (size - 1) : 1;
+
+    switch (rand() % 5) {
+      case 0: // Flip a bit
+        if (size > 1) {
+          data[pos] ^= 1 << (rand() % 8);
+        }
+        break;
+
+      case 1: // Random byte
+        if (size > 1) {
+          data[pos] = rand();
+        }
+        break;
+
+      case 2: // Append a random instruction
+        if (size + 2 <= MAX_INPUT) {
+          data[size++] = rand();
+          data[size++] = rand();
+        }
+        break;
+
+      case 3: // Duplicate a chunk
+        if ((size > 2) && (size + 16 <= MAX_INPUT)) {
+          size_t from = 1 + rand() % (size - 1);
+          size_t len = 1 + rand() % 16;
+          if (from + len > size) {
+            len = size - from;
+          }
+          memmove(data + size, data + from, len);
+          size += len;
+        }
+        break;
+
+      case 4: // New key script length
+        data[0] = rand() % 8;
+        break;
+    }
+  }
+  return size;
+} /* mutate() */
+
+/*
+ *  Maps a nonzero hit count to a single bit, AFL style: 1, 2, 3, 4-7, 8-15,
+ *  16-31, 32-127 and 128+ hits each get their own bit.
+ */
+
+static unsigned char count_class(unsigned char count) {
+  if (count < 3) {
+    return count;
+  }
+  if (count == 3) {
+    return 4;
+  }
+  if (count < 8) {
+    return 8;
+  }
+  if (count < 16) {
+    return 16;
+  }
+  if (count < 32) {
+    return 32;
+  }
+  return count < 128 ? 64 : 128;
+} /* count_class() */
+
+/*
+ *  Merges this run's coverage into seen, returning true if it hit an edge
+ *  (or an edge count bucket) not seen before.
+ */
+
+static bool new_coverage(unsigned char *seen) {
+  bool found = false;
+
+  for (int i = 0; i < COVERAGE_SIZE; i++) {
+    if (coverage[i]) {
+      unsigned char bucket = count_class(coverage[i]);
+      if (!(seen[i] & bucket)) {
+        seen[i] |= bucket;
+        found = true;
+      }
+    }
+  }
+  return found;
+} /* new_coverage() */
+
+#endif
@@ -0,0 +1,175 @@
+#include "gym.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void reset_env(gym_t *, int);
+
+/*
+ *  Allocates a batch of n_envs machines for the rom in spec, each one reset
+ *  as by gym_reset() with DEFAULT_SEED. Returns NULL if the rom doesn't fit
+ *  in memory or allocation fails.
+ */
+
+gym_t *gym_create(const gym_spec_t *spec, int n_envs) {
+  if ((n_envs <= 0) || (spec->rom_size > ROM_MAX_SIZE) || !spec->score) {
+    return NULL;
+  }
+
+  gym_t *gym = aligned_alloc(CACHE_LINE, sizeof(gym_t)); // Holds a ch8_t
+  if (!gym) {
+    return NULL;
+  }
+  memset(gym, 0, sizeof(gym_t));
+
+  gym->spec = *spec;
+  if (gym->spec.frames_per_step < 1) {
+    gym->spec.frames_per_step = 1;
+  }
+  gym->n_envs = n_envs;
+
+  initialize(&gym->initial, DEFAULT_SEED);
+  memcpy(gym->initial.memory + ROM_START, spec->rom, spec->rom_size);
+  state_rehash(&gym->initial);
+
+  gym->envs = alloc_machines(n_envs);
+  gym->scores = calloc(n_envs, sizeof(long));
+  gym->steps = calloc(n_envs, sizeof(int));
+  gym->seeds = calloc(n_envs, sizeof(uint32_t));
+  gym->needs_reset = calloc(n_envs, sizeof(bool));
+  if (!gym->envs || !gym->scores || !gym->steps || !gym->seeds ||
+      !gym->needs_reset) {
+    gym_destroy(gym);
+    return NULL;
+  }
+
+  gym_reset(gym, DEFAULT_SEED, NULL);
+  return gym;
+} /* gym_create() */
+
+/*
+ *  Frees the batch.
+ */
+
+void gym_destroy(gym_t *gym) {
+  if (!gym) {
+    return;
+  }
+  free(gym->envs);
+  free(gym->scores);
+  free(gym->steps);
+  free(gym->seeds);
+  free(gym->needs_reset);
+  free(gym);
+} /* gym_destroy() */
+
+/*
+ *  Starts a new episode in every machine, machine i being seeded with
+ *  seed + i, and writes the first observations to obs (n_envs * OBS_WORDS
+ *  words) if it isn't NULL.
+ */
+
+void gym_reset(gym_t *gym, uint32_t seed, uint64_t *obs) {
+  for (int i = 0; i < gym->n_envs; i++) {
+    gym->seeds[i] = seed + i;
+    reset_env(gym, i);
+    if (obs) {
+      gym_observe(&gym->envs[i], obs + i * OBS_WORDS);
+    }
+  }
+} /* gym_reset() */
+
+/*
+ *  Advances the first n_envs machines by one step each, holding down the keys
+ *  in actions[i] (bit N for key N). Writes each machine's observation, the
+ *  change in score as the reward, and whether the episode ended. A machine
+ *  whose episode ended starts a new one on its next step, with its seed
+ *  advanced by n_envs so episodes don't repeat.
+ */
+
+void gym_step(gym_t *gym, const uint16_t *actions, int n_envs, uint64_t *obs,
+              float *rewards, bool *dones) {
+  if (n_envs > gym->n_envs) {
+    n_envs = gym->n_envs;
+  }
+
+  for (int i = 0; i < n_envs; i++) {
+    ch8_t *ch8 = &gym->envs[i];
+    bool draw_flag = false;
+
+    if (gym->needs_reset[i]) {
+      gym->seeds[i] += gym->n_envs;
+      reset_env(gym, i);
+    }
+
+    set_keys(ch8, actions[i]);
+    for (int f = 0; (f < gym->spec.frames_per_step) && !ch8->halted; f++) {
+      run_frame(ch8, &draw_flag);
+    }
+    gym->steps[i]++;
+
+    long score = gym->spec.score(ch8);
+    rewards[i] = (float) (score - gym->scores[i]);
+    gym->scores[i] = score;
+
+    dones[i] = ch8->halted ||
+               ((gym->spec.max_steps > 0) &&
+                (gym->steps[i] >= gym->spec.max_steps)) ||
+               (gym->spec.done && gym->spec.done(ch8));
+    gym->needs_reset[i] = dones[i];
+
+    gym_observe(ch8, obs + i * OBS_WORDS);
+  }
+} /* gym_step() */
+
+/*
+ *  Writes the 64x32 observation of a machine, one word per row with the
+ *  leftmost pixel in the top bit. Low resolution frames are copied straight
+ *  from the packed first plane; high resolution frames are reduced by ORing
+ *  each 2x2 block of pixels.
+ */
+
+void gym_observe(const ch8_t *ch8, uint64_t *obs) {
+  if (!ch8->hires) {
+    memcpy(obs, ch8->gfx[0], OBS_SIZE);
+    return;
+  }
+
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    const uint64_t *rows = ch8->gfx[0] + y * 4; // Two rows of two words
+    uint64_t row = 0;
+
+    for (int w = 0; w < 2; w++) {
+      uint64_t bits = rows[w] | rows[w + 2];
+      for (int x = 0; x < 32; x++) {
+        uint64_t pair = (bits >> (62 - 2 * x)) & 0x3;
+        row |= (uint64_t) (pair != 0) << (63 - (w * 32 + x));
+      }
+    }
+    obs[y] = row;
+  }
+} /* gym_observe() */
+
+/*
+ *  Score extractor for the bundled pong.rom, playing the left paddle (keys 1
+ *  and 4): its points less the right paddle's. The rom keeps the score in VE
+ *  as left * 10 + right and stores its digits with FX33 at 0x2F2 to draw
+ *  them, so the tens and ones digits there are the two players' points.
+ */
+
+long pong_score(const ch8_t *ch8) {
+  return (long) ch8->memory[PONG_SCORE_ADDR + 1] -
+         ch8->memory[PONG_SCORE_ADDR + 2];
+} /* pong_score() */
+
+/*
+ *  Puts machine i back to the start of the rom with its current seed.
+ */
+
+static void reset_env(gym_t *gym, int i) {
+  gym->envs[i] = gym->initial;
+  gym->envs[i].rng = gym->seeds[i] ? gym->seeds[i] : DEFAULT_SEED;
+  gym->scores[i] = gym->spec.score(&gym->envs[i]);
+  gym->steps[i] = 0;
+  gym->needs_reset[i] = false;
+} /* reset_env() */
@@ -0,0 +1,53 @@
+#ifndef GYM_H
+#define GYM_H
+
+#include "chip8.h"
+
+#include <stddef.h>
+
+#define OBS_WORDS (DISPLAY_HEIGHT) // One 64-bit word per 64 pixel row
+#define OBS_SIZE (OBS_WORDS * sizeof(uint64_t)) // 256 bytes per observation
+
+#define PONG_SCORE_ADDR (0x2F2) // FX33 digits of the score in pong.rom
+
+/*
+ *  Reinforcement learning environment over a batch of machines. All machines
+ *  run the same rom and live in one contiguous array allocated up front, so
+ *  stepping the batch never allocates.
+ *
+ *  score() returns the game's current score read out of the machine (usually
+ *  from memory), and the reward for a step is how much it changed. Score
+ *  extractors for known roms are below, e.g. pong_score() for pong.rom. done() is
+ *  optional and ends an episode early, otherwise episodes end when the rom
+ *  halts or after max_steps steps.
+ */
+
+typedef struct gym_spec {
+  const unsigned char *rom;
+  size_t rom_size;
+  int frames_per_step; // Frames each action is held for
+  int max_steps; // 0 for no limit
+  long (*score)(const ch8_t *);
+  bool (*done)(const ch8_t *);
+} gym_spec_t;
+
+typedef struct gym {
+  gym_spec_t spec;
+  int n_envs;
+  ch8_t initial; // Machine with the rom loaded, copied on reset
+  ch8_t *envs;
+  long *scores;
+  int *steps;
+  uint32_t *seeds;
+  bool *needs_reset;
+} gym_t;
+
+gym_t *gym_create(const gym_spec_t *, int);
+void gym_destroy(gym_t *);
+void gym_reset(gym_t *, uint32_t, uint64_t *);
+void gym_step(gym_t *, const uint16_t *, int, uint64_t *, float *, bool *);
+void gym_observe(const ch8_t *, uint64_t *);
+
+long pong_score(const ch8_t *);
+
+#endif
@@ -0,0 +1,232 @@
+#include "gym.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *  Test of the batch environment API on pong.rom, playing the left paddle
+ *  with pong_score(). Checks that:
+ *
+ *    - a batch can be stepped straight after gym_create(), the same as
+ *      after gym_reset() with DEFAULT_SEED
+ *    - each step's observation is the machine's screen, and a high
+ *      resolution screen is reduced by ORing 2x2 blocks
+ *    - the rewards of an episode add up to the score it ended on
+ *    - episodes end at max_steps and the next step starts a new one
+ *    - runs with the same seed and actions are identical
+ *
+ *  Usage: chip8-gym-test [rom]
+ */
+
+#define ENVS (8)
+#define STEPS (600)
+#define FRAMES_PER_STEP (4)
+#define MAX_STEPS (250)
+
+typedef struct run {
+  uint64_t obs[ENVS * OBS_WORDS];
+  float rewards[ENVS];
+  bool dones[ENVS];
+  long returns[ENVS]; // Rewards summed over the current episode
+  int episodes; // Ended, over all envs
+  int scored; // Steps with a nonzero reward
+  uint64_t hash; // Of every observation and reward
+} run_t;
+
+static unsigned char *read_rom(const char *, size_t *);
+static int run(gym_t *, bool, uint32_t, run_t *);
+static uint16_t action(int, int);
+static bool check_hires(void);
+static void expected_obs(const ch8_t *, uint64_t *);
+static int pixel(const ch8_t *, int, int);
+
+int main(int argc, char *argv[]) {
+  const char *rom_name = (argc > 1) ? argv[1] : "pong.rom";
+  size_t rom_size = 0;
+  unsigned char *rom = read_rom(rom_name, &rom_size);
+  if (!rom) {
+    fprintf(stderr, "Can't load %s\n", rom_name);
+    return 1;
+  }
+
+  gym_spec_t spec = {
+    .rom = rom,
+    .rom_size = rom_size,
+    .frames_per_step = FRAMES_PER_STEP,
+    .max_steps = MAX_STEPS,
+    .score = pong_score
+  };
+  gym_t *gyms[2] = { gym_create(&spec, ENVS), gym_create(&spec, ENVS) };
+  run_t *runs = calloc(3, sizeof(run_t));
+  if (!gyms[0] || !gyms[1] || !runs) {
+    fprintf(stderr, "Can't create the environments\n");
+    return 1;
+  }
+
+  int failed = 0;
+  failed += run(gyms[0], false, 0, &runs[0]);
+  failed += run(gyms[1], true, DEFAULT_SEED, &runs[1]);
+  failed += run(gyms[1], true, DEFAULT_SEED, &runs[2]);
+
+  bool fresh = runs[0].hash == runs[1].hash;
+  printf("%s step without reset\n", fresh ? "PASS" : "FAIL");
+  bool same = runs[1].hash == runs[2].hash;
+  printf("%s same seed, same run\n", same ? "PASS" : "FAIL");
+  bool scored = runs[1].scored > 0;
+  printf("%s %d rewards, %d episodes\n", scored ? "PASS" : "FAIL",
+         runs[1].scored, runs[1].episodes);
+  bool hires = check_hires();
+  printf("%s high resolution observation\n", hires ? "PASS" : "FAIL");
+  failed += !fresh + !same + !scored + !hires;
+
+  gym_destroy(gyms[0]);
+  gym_destroy(gyms[1]);
+  free(runs);
+  free(rom);
+  printf("%d failed\n", failed);
+  return failed != 0;
+} /* main() */
+
+/*
+ *  Steps a batch STEPS times, resetting it first if asked, checking each
+ *  step as it goes. Returns the number of checks that failed.
+ */
+
+static int run(gym_t *gym, bool reset, uint32_t seed, run_t *result) {
+  int failed = 0;
+
+  memset(result, 0, sizeof(*result));
+  result->hash = 0xCBF29CE484222325;
+  if (reset) {
+    gym_reset(gym, seed, result->obs);
+  }
+
+  for (int step = 0; step < STEPS; step++) {
+    uint16_t actions[ENVS];
+    for (int i = 0; i < ENVS; i++) {
+      actions[i] = action(step, i);
+    }
+    gym_step(gym, actions, ENVS, result->obs, result->rewards,
+             result->dones);
+
+    for (int i = 0; i < ENVS; i++) {
+      const ch8_t *ch8 = &gym->envs[i];
+      uint64_t obs[OBS_WORDS];
+
+      expected_obs(ch8, obs);
+      if (memcmp(obs, result->obs + i * OBS_WORDS, OBS_SIZE) != 0) {
+        printf("FAIL step %d env %d: observation isn't the screen\n", step,
+               i);
+        failed++;
+      }
+
+      result->returns[i] += (long) result->rewards[i];
+      result->scored += result->rewards[i] != 0;
+      if (result->dones[i]) {
+        // Each episode starts at 0 to 0
+        if (result->returns[i] != pong_score(ch8)) {
+          printf("FAIL step %d env %d: rewards add up to %ld, score is %ld\n",
+                 step, i, result->returns[i], pong_score(ch8));
+          failed++;
+        }
+        if (gym->steps[i] != MAX_STEPS) {
+          printf("FAIL step %d env %d: episode ended after %d steps\n", step,
+                 i, gym->steps[i]);
+          failed++;
+        }
+        result->returns[i] = 0;
+        result->episodes++;
+      }
+
+      for (int w = 0; w < OBS_WORDS; w++) {
+        result->hash = (result->hash ^ result->obs[i * OBS_WORDS + w]) *
+                       0x100000001B3;
+      }
+      result->hash = (result->hash ^ (uint64_t) (long) result->rewards[i]) *
+                     0x100000001B3;
+    }
+  }
+  return failed;
+} /* run() */
+
+/*
+ *  Fills a high resolution screen with a pattern and checks its observation
+ *  against one worked out pixel by pixel.
+ */
+
+static bool check_hires(void) {
+  static ch8_t ch8;
+  uint64_t obs[OBS_WORDS];
+  uint64_t expected[OBS_WORDS];
+  uint64_t word = 0x9E3779B97F4A7C15;
+
+  initialize(&ch8, DEFAULT_SEED);
+  ch8.hires = true;
+  for (int i = 0; i < GFX_WORDS; i++) {
+    word ^= word << 13;
+    word ^= word >> 7;
+    word ^= word << 17;
+    // Sparse, so some 2x2 blocks are empty
+    ch8.gfx[0][i] = word & (word >> 1) & (word >> 2);
+  }
+
+  gym_observe(&ch8, obs);
+  expected_obs(&ch8, expected);
+  return memcmp(obs, expected, OBS_SIZE) == 0;
+} /* check_hires() */
+
+/*
+ *  The observation of a machine, built a pixel at a time from the first
+ *  plane rather than the way gym_observe() does it.
+ */
+
+static void expected_obs(const ch8_t *ch8, uint64_t *obs) {
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    obs[y] = 0;
+    for (int x = 0; x < DISPLAY_WIDTH; x++) {
+      int on = ch8->hires ? pixel(ch8, 2 * x, 2 * y) |
+                            pixel(ch8, 2 * x + 1, 2 * y) |
+                            pixel(ch8, 2 * x, 2 * y + 1) |
+                            pixel(ch8, 2 * x + 1, 2 * y + 1)
+                          : pixel(ch8, x, y);
+      obs[y] |= (uint64_t) on << (63 - x);
+    }
+  }
+} /* expected_obs() */
+
+/*
+ *  Whether a pixel of the first plane is lit, in the current resolution.
+ */
+
+static int pixel(const ch8_t *ch8, int x, int y) {
+  int row_words = ch8->hires ? HIRES_WIDTH / 64 : 1;
+  uint64_t word = ch8->gfx[0][y * row_words + x / 64];
+  return (word >> (63 - x % 64)) & 1;
+} /* pixel() */
+
+/*
+ *  Keys held by env i at a step: up (1), down (4) or nothing, changing every
+ *  few steps and differing between envs.
+ */
+
+static uint16_t action(int step, int i) {
+  static const uint16_t keys[] = { 0, 1 << 0x1, 1 << 0x4 };
+  return keys[(step / 8 + i * 7 + step * i / 50) % 3];
+} /* action() */
+
+/*
+ *  Reads a whole rom file, returning NULL if it can't.
+ */
+
+static unsigned char *read_rom(const char *name, size_t *size) {
+  FILE *file = fopen(name, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  unsigned char *rom = malloc(RAM_SIZE);
+  *size = rom ? fread(rom, 1, RAM_SIZE, file) : 0;
+  fclose(file);
+  return rom;
+} /* read_rom() */
@@ -0,0 +1,171 @@
+#include "log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static void *flusher(void *);
+
+// Message for each event, given the value and pc in that order
+static const char *formats[LOG_EVENT_COUNT] = {
+  [LOG_UNKNOWN_OPCODE] = "Unknown opcode 0x%04X at 0x%03X",
+  [LOG_BEEP] = "Beep!",
+  [LOG_KEY_DOWN] = "Key down 0x%X",
+  [LOG_KEY_UP] = "Key up 0x%X"
+};
+
+/*
+ *  Starts an empty ring with nothing seen.
+ */
+
+void log_init(log_ring_t *ring) {
+  memset(ring->records, 0, sizeof(ring->records));
+  memset(ring->seen, 0, sizeof(ring->seen));
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->dropped, 0);
+  atomic_init(&ring->tail, 0);
+  ring->reported = 0;
+} /* log_init() */
+
+/*
+ *  Producer side: counts an event and, if the count is a power of two,
+ *  appends a record of it. Never blocks or allocates.
+ */
+
+void log_event(log_ring_t *ring, log_event_t event, uint16_t pc,
+               uint32_t value, uint64_t clock) {
+  uint64_t key = (uint64_t) event << 48 | (uint64_t) pc << 32 | value;
+  int slot = (key ^ key >> 29 ^ key >> 47) % LOG_DEDUPE_SIZE;
+
+  // A different event in the slot is forgotten and starts over if it comes
+  // back, which only costs an extra record.
+  if (ring->seen[slot].key != key) {
+    ring->seen[slot].key = key;
+    ring->seen[slot].count = 0;
+  }
+  uint32_t count = ++ring->seen[slot].count;
+  if (count & (count - 1)) {
+    return;
+  }
+
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail == LOG_RING_SIZE) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  ring->records[head % LOG_RING_SIZE] = (log_record_t) {
+    .clock = clock,
+    .value = value,
+    .count = count,
+    .event = event,
+    .pc = pc
+  };
+
+  // Release makes the record visible before the index is.
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+} /* log_event() */
+
+/*
+ *  Consumer side: formats every record in the ring to file, one line each.
+ *  Returns the number of records written.
+ */
+
+int log_drain(log_ring_t *ring, FILE *file) {
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  int written = 0;
+
+  for (; tail != head; tail++, written++) {
+    const log_record_t *record = &ring->records[tail % LOG_RING_SIZE];
+    if (record->event < LOG_EVENT_COUNT) {
+      fprintf(file, formats[record->event], record->value, record->pc);
+    }
+    if (record->count > 1) {
+      fprintf(file, " (seen %u times)", record->count);
+    }
+    fputc('\n', file);
+  }
+  atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+  unsigned int dropped = atomic_load_explicit(&ring->dropped,
+                                              memory_order_relaxed);
+  if (dropped != ring->reported) {
+    fprintf(file, "%u log records dropped\n", dropped - ring->reported);
+    ring->reported = dropped;
+  }
+
+  if (written) {
+    fflush(file);
+  }
+  return written;
+} /* log_drain() */
+
+/*
+ *  Starts a thread draining the rings to file every LOG_FLUSH_MS. The rings
+ *  must each be drained by nothing else meanwhile.
+ */
+
+void log_flusher_start(log_flusher_t *log_flusher, log_ring_t **rings,
+                       int ring_count, FILE *file) {
+  log_flusher->rings = rings;
+  log_flusher->ring_count = ring_count;
+  log_flusher->file = file;
+  log_flusher->stopping = false;
+  pthread_mutex_init(&log_flusher->lock, NULL);
+  pthread_cond_init(&log_flusher->stop, NULL);
+  pthread_create(&log_flusher->thread, NULL, flusher, log_flusher);
+} /* log_flusher_start() */
+
+/*
+ *  Stops the flusher thread after a last drain.
+ */
+
+void log_flusher_stop(log_flusher_t *log_flusher) {
+  pthread_mutex_lock(&log_flusher->lock);
+  log_flusher->stopping = true;
+  pthread_cond_signal(&log_flusher->stop);
+  pthread_mutex_unlock(&log_flusher->lock);
+
+  pthread_join(log_flusher->thread, NULL);
+  pthread_mutex_destroy(&log_flusher->lock);
+  pthread_cond_destroy(&log_flusher->stop);
+} /* log_flusher_stop() */
+
+/*
+ *  Flusher thread: drains every ring, then sleeps until the next flush or
+ *  until stopped.
+ */
+
+static void *flusher(void *arg) {
+  log_flusher_t *log_flusher = arg;
+  bool stopping = false;
+
+  while (!stopping) {
+    for (int i = 0; i < log_flusher->ring_count; i++) {
+      log_drain(log_flusher->rings[i], log_flusher->file);
+    }
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += LOG_FLUSH_MS * 1000000L;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(&log_flusher->lock);
+    int waited = 0;
+    while (!log_flusher->stopping && (waited != ETIMEDOUT)) {
+      waited = pthread_cond_timedwait(&log_flusher->stop, &log_flusher->lock,
+                                      &until);
+    }
+    stopping = log_flusher->stopping;
+    pthread_mutex_unlock(&log_flusher->lock);
+  }
+
+  // Anything logged before the stop
+  for (int i = 0; i < log_flusher->ring_count; i++) {
+    log_drain(log_flusher->rings[i], log_flusher->file);
+  }
+  return NULL;
+} /* flusher() */
@@ -0,0 +1,75 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOG_RING_SIZE (256) // Records, a power of two
+#define LOG_DEDUPE_SIZE (64) // Recent distinct events counted for dedupe
+#define LOG_FLUSH_MS (100) // How often the flusher thread drains
+
+/*
+ *  Logging that stays off the emulation's hot path. Events are written as
+ *  fixed-size binary records into a lock-free ring with one producer and
+ *  one consumer, and only formatted when the ring is drained, either on
+ *  demand with log_drain() or every LOG_FLUSH_MS by a flusher thread.
+ *
+ *  Repeats are rate-limited: each distinct event (kind, pc and value) is
+ *  counted, and a record only goes out the 1st, 2nd, 4th, 8th... time it's
+ *  seen, carrying the count. A rom stuck on an unknown opcode logs a
+ *  handful of lines rather than one per instruction. A full ring drops
+ *  records rather than block, and the drops are reported when drained.
+ */
+
+typedef enum log_event {
+  LOG_UNKNOWN_OPCODE, // value is the opcode
+  LOG_BEEP,
+  LOG_KEY_DOWN, // value is the host key code
+  LOG_KEY_UP,
+  LOG_EVENT_COUNT
+} log_event_t;
+
+typedef struct log_record {
+  uint64_t clock; // Machine frame the event happened in
+  uint32_t value;
+  uint32_t count; // Times this event has been seen
+  uint16_t event; // A log_event_t
+  uint16_t pc;
+} log_record_t;
+
+typedef struct log_ring {
+  log_record_t records[LOG_RING_SIZE];
+
+  // Each index on its own cache line, since each is written by one thread
+  _Alignas(64) atomic_uint head; // Next record the producer writes
+  atomic_uint dropped;
+  _Alignas(64) atomic_uint tail; // Next record the consumer reads
+  unsigned int reported; // Drops already reported by the consumer
+
+  // Producer side dedupe counts, keyed by event, pc and value
+  struct {
+    uint64_t key;
+    uint32_t count;
+  } seen[LOG_DEDUPE_SIZE];
+} log_ring_t;
+
+typedef struct log_flusher {
+  log_ring_t **rings;
+  int ring_count;
+  FILE *file;
+  bool stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t stop;
+  pthread_t thread;
+} log_flusher_t;
+
+void log_init(log_ring_t *);
+void log_event(log_ring_t *, log_event_t, uint16_t, uint32_t, uint64_t);
+int log_drain(log_ring_t *, FILE *);
+void log_flusher_start(log_flusher_t *, log_ring_t **, int, FILE *);
+void log_flusher_stop(log_flusher_t *);
+
+#endif
@@ -1,40 +1,228 @@
 #include "main.h"
+#include "capture.h"
+#include "clone.h"
+#include "debug.h"
+#include "log.h"
+#include "movie.h"
+#include "netplay.h"
+#include "pacer.h"
+#include "scan.h"
+#include "triple.h"
 
 #include "include/SDL2/SDL.h"
 #include "include/SDL2/SDL_events.h"
 #include "include/SDL2/SDL_render.h"
 #include "include/SDL2/SDL_video.h"
 
+#include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define DELAY_RATE (1000/60) // 1000/60 is 60 FPS
-#define DISPLAY_SCALE (20)
-
 static ch8_t ch8; 
+static debugger_t debugger;
+
+// What the audio callback plays, copied from the machine after each batch of
+// committed frames under the audio device lock.
+typedef struct sound {
+  bool playing;
+  unsigned char pitch;
+  unsigned char pattern[AUDIO_PATTERN_SIZE];
+} sound_t;
+
+// Everything the emulation thread shares with the main (render) thread. The
+// machine belongs to the emulation thread, except while it's parked for the
+// debugger.
+typedef struct emulation {
+  atomic_bool quit;
+  atomic_bool turbo;
+  atomic_bool paused; // The debugger wants the machine, or has it
+  atomic_bool parked; // The emulation thread has let go of it
+  atomic_uint keys; // Keypad mask, applied at the start of each frame
+  atomic_bool frame_pending; // A frame event is queued for the main thread
+  Uint32 frame_event;
+  SDL_sem *wake; // Posted on input, quit and F1, to wake an idle machine
+
+  int frameskip; // Present every Nth frame in turbo, 0 caps at 60 Hz
+  int runahead; // Frames to run ahead of the real machine before presenting
+  bool print_stats;
+  movie_t *movie;
+  capture_t *capture;
+  netplay_t *netplay;
+  triple_buffer_t frames;
+  SDL_AudioDeviceID audio;
+  sound_t sound;
+
+  SDL_mutex *stats_lock;
+  char stats[128];
+  atomic_bool stats_fresh;
+} emulation_t;
+
+static emulation_t emulation;
+static netplay_t netplay;
+
+// The core logs to one ring and the input handling to another, since each
+// ring has a single producer.
+static log_ring_t machine_log;
+static log_ring_t input_log;
+
+// Colors for each combination of the two planes
+static const unsigned char palette[1 << GFX_PLANES][3] = {
+  { 0, 0, 0 },
+  { 255, 0, 255 },
+  { 0, 255, 255 },
+  { 255, 255, 255 }
+};
 
 // Prototypes
-void initialize();
-bool load_rom(char *);
-void emulate_cycle(bool *);
-void draw(SDL_Renderer **);
+int replay(const char *, const char *);
+int headless(const char *, uint32_t, long, const char *, int, bool);
+bool open_rom(const char *, bool);
+void finish_capture(capture_t *);
+int emulation_thread(void *);
+void idle_sleep(frame_pacer_t *);
+void draw(SDL_Renderer **, const frame_t *);
 void handle_input(SDL_Event *);
-void beep();
 
-int main() {
+void copy_sound(sound_t *, const ch8_t *);
+void audio_callback(void *, Uint8 *, int);
+
+int main(int argc, char *argv[]) {
   printf("Welcome to Sprocket's Chip-8 Emulator...\n");
 
-  initialize();
+  char *rom_name = "pong.rom";
+  bool vsync = false;
+  bool print_stats = false;
+  bool turbo = false;
+  int frameskip = 0;
+  int runahead = 0;
+  uint32_t seed = time(0);
+  bool seed_given = false;
+  char *record_name = NULL;
+  char *replay_name = NULL;
+  fault_policy_t fault_policy = FAULT_REPORT;
+  bool debug = false;
+  bool check = false; // Scan the rom and refuse it if it has problems
+  char *capture_name = NULL;
+  int capture_scale = 1;
+  long headless_frames = 0; // Run this many frames without a window
+  int netplay_port = 0;
+  char *netplay_peer = NULL; // host:port
+  int latency = 0;
+  int loss = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--vsync") == 0) {
+      vsync = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      print_stats = true;
+    } else if (strcmp(argv[i], "--turbo") == 0) {
+      turbo = true;
+    } else if ((strcmp(argv[i], "--frameskip") == 0) && (i + 1 < argc)) {
+      frameskip = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "--runahead") == 0) && (i + 1 < argc)) {
+      runahead = atoi(argv[++i]);
+      runahead = (runahead < 0) ? 0 :
+                 (runahead > MAX_RUNAHEAD) ? MAX_RUNAHEAD : runahead;
+    } else if ((strcmp(argv[i], "--seed") == 0) && (i + 1 < argc)) {
+      seed = strtoul(argv[++i], NULL, 0);
+      seed_given = true;
+    } else if ((strcmp(argv[i], "--record") == 0) && (i + 1 < argc)) {
+      record_name = argv[++i];
+    } else if ((strcmp(argv[i], "--replay") == 0) && (i + 1 < argc)) {
+      replay_name = argv[++i];
+    } else if ((strcmp(argv[i], "--capture") == 0) && (i + 1 < argc)) {
+      capture_name = argv[++i];
+    } else if ((strcmp(argv[i], "--scale") == 0) && (i + 1 < argc)) {
+      capture_scale = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "--headless") == 0) && (i + 1 < argc)) {
+      headless_frames = atol(argv[++i]);
+    } else if ((strcmp(argv[i], "--netplay") == 0) && (i + 2 < argc)) {
+      netplay_port = atoi(argv[++i]);
+      netplay_peer = argv[++i];
+    } else if ((strcmp(argv[i], "--latency") == 0) && (i + 1 < argc)) {
+      latency = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "--loss") == 0) && (i + 1 < argc)) {
+      loss = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else if (strcmp(argv[i], "--debug") == 0) {
+      debug = true;
+    } else if ((strcmp(argv[i], "--faults") == 0) && (i + 1 < argc)) {
+      i++;
+      fault_policy = (strcmp(argv[i], "wrap") == 0) ? FAULT_WRAP :
+                     (strcmp(argv[i], "halt") == 0) ? FAULT_HALT : FAULT_REPORT;
+    } else {
+      rom_name = argv[i];
+    }
+  }
+
+  if (replay_name) {
+    return replay(rom_name, replay_name);
+  }
+
+  if (headless_frames > 0) {
+    return headless(rom_name, seed, headless_frames, capture_name,
+                    capture_scale, check);
+  }
+
+  // Both peers must start identical, so netplay uses a fixed seed unless
+  // both sides give the same one.
+  if (netplay_peer && !seed_given) {
+    seed = DEFAULT_SEED;
+  }
+
+  initialize(&ch8, seed);
+  ch8.fault_policy = fault_policy;
   printf("Emulator initialized!\n");
 
-  if(!load_rom("pong.rom")) {
-    printf("Failed to load rom! Exiting...\n");
+  if (!open_rom(rom_name, check)) {
     return 0;
   }
   printf("Rom Loaded...\n");
 
+  if (netplay_peer) {
+    char host[256];
+    int port = 0;
+    if ((sscanf(netplay_peer, "%255[^:]:%d", host, &port) != 2) ||
+        !netplay_open(&netplay, &ch8, netplay_port, host, port)) {
+      printf("Can't start netplay with %s\n", netplay_peer);
+      return 1;
+    }
+    netplay_simulate(&netplay, latency, loss, seed);
+
+    // Only the keys go over the wire, so nothing may run frames the peer
+    // doesn't know about.
+    if (record_name || turbo || runahead) {
+      printf("Recording, turbo and run-ahead are off for netplay\n");
+    }
+    record_name = NULL;
+    turbo = false;
+    runahead = 0;
+  }
+
+  movie_t movie;
+  if (record_name) {
+    movie_init(&movie, &ch8, seed);
+  }
+
+  capture_t capture;
+  if (capture_name && !capture_open(&capture, capture_name, capture_scale,
+                                    palette)) {
+    printf("Can't capture to %s\n", capture_name);
+    capture_name = NULL;
+  }
+
+  log_flusher_t log_flusher;
+  log_ring_t *log_rings[] = { &machine_log, &input_log };
+  log_init(&machine_log);
+  log_init(&input_log);
+  ch8.log = &machine_log;
+  log_flusher_start(&log_flusher, log_rings, 2, stdout);
+
   bool draw_flag = false;
 
   SDL_Event event;
@@ -42,28 +230,144 @@ int main() {
   SDL_Window *window;
 
   SDL_Init(SDL_INIT_EVERYTHING);
-  SDL_CreateWindowAndRenderer(DISPLAY_WIDTH * DISPLAY_SCALE,
-                              DISPLAY_HEIGHT * DISPLAY_SCALE, 0, &window,
-                              &renderer);
+  window = SDL_CreateWindow("Chip-8", SDL_WINDOWPOS_UNDEFINED,
+                            SDL_WINDOWPOS_UNDEFINED,
+                            DISPLAY_WIDTH * DISPLAY_SCALE,
+                            DISPLAY_HEIGHT * DISPLAY_SCALE, 0);
+  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED |
+                                (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
   SDL_RenderClear(renderer);
 
-  while (true) {
-    if (SDL_PollEvent(&event) && event.type == SDL_QUIT) {
-      break;
+  SDL_AudioSpec want = {0};
+  want.freq = AUDIO_FREQ;
+  want.format = AUDIO_U8;
+  want.channels = 1;
+  want.samples = 512;
+  want.callback = audio_callback;
+  want.userdata = &emulation.sound;
+  copy_sound(&emulation.sound, &ch8);
+  SDL_AudioDeviceID audio = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+  emulation.audio = audio;
+  SDL_PauseAudioDevice(audio, 0);
+
+  debug_init(&debugger);
+  debugger.paused = debug;
+  if (debug) {
+    printf("Starting paused, type h for debugger commands\n");
+    debug_show_code(&ch8, ch8.pc, 0);
+  }
+
+  // The machine runs on its own thread, paced by its own clock, so a slow
+  // present never holds it up. This thread handles input and presents
+  // whichever frame is newest when it gets to it.
+  atomic_init(&emulation.quit, false);
+  atomic_init(&emulation.turbo, turbo);
+  atomic_init(&emulation.paused, debug);
+  atomic_init(&emulation.parked, false);
+  atomic_init(&emulation.keys, 0);
+  atomic_init(&emulation.frame_pending, false);
+  atomic_init(&emulation.stats_fresh, false);
+  emulation.frame_event = SDL_RegisterEvents(1);
+  emulation.wake = SDL_CreateSemaphore(0);
+  emulation.frameskip = frameskip;
+  emulation.runahead = runahead;
+  emulation.print_stats = print_stats;
+  emulation.movie = record_name ? &movie : NULL;
+  emulation.capture = capture_name ? &capture : NULL;
+  emulation.netplay = netplay_peer ? &netplay : NULL;
+  emulation.stats_lock = SDL_CreateMutex();
+  triple_init(&emulation.frames);
+
+  SDL_Thread *thread = SDL_CreateThread(emulation_thread, "emulation", NULL);
+  bool quit = false;
+
+  while (!quit) {
+    if (atomic_load(&emulation.paused)) {
+      if (!atomic_load(&emulation.parked)) {
+        SDL_Delay(1); // Wait for the current frame to finish
+        continue;
+      }
+
+      // The debugger reads commands from stdin, so events wait meanwhile.
+      debugger.paused = true;
+      quit = !debug_prompt(&debugger, &ch8, &draw_flag);
+      if (draw_flag) {
+        frame_t frame;
+        frame_copy(&frame, &ch8, 0);
+        draw(&renderer, &frame);
+        draw_flag = false;
+      }
+      while (SDL_PollEvent(&event)) {
+        quit = quit || (event.type == SDL_QUIT);
+        handle_input(&event);
+      }
+      set_keys(&ch8, atomic_load(&emulation.keys));
+      atomic_store(&emulation.paused, debugger.paused);
+      continue;
     }
 
-    handle_input(&event);
+    // Sleep until there's input or a new frame.
+    if (!SDL_WaitEventTimeout(&event, 100)) {
+      continue;
+    }
 
-    emulate_cycle(&draw_flag);
-  
-    if (draw_flag) {
-      draw(&renderer);
-      draw_flag = false;
+    bool fresh = false;
+    do {
+      if (event.type == SDL_QUIT) {
+        quit = true;
+      } else if (event.type == emulation.frame_event) {
+        atomic_store(&emulation.frame_pending, false);
+        fresh = true;
+      } else if ((event.type == SDL_KEYDOWN) && !event.key.repeat &&
+                 (event.key.keysym.sym == SDLK_TAB) && !emulation.netplay) {
+        atomic_store(&emulation.turbo, !atomic_load(&emulation.turbo));
+      } else if ((event.type == SDL_KEYDOWN) &&
+                 (event.key.keysym.sym == SDLK_F1)) {
+        atomic_store(&emulation.paused, true); // F1 breaks into the debugger
+        SDL_SemPost(emulation.wake);
+      }
+      handle_input(&event);
+    } while (SDL_PollEvent(&event));
+
+    if (fresh) {
+      const frame_t *frame = triple_acquire(&emulation.frames, &fresh);
+      if (fresh) {
+        draw(&renderer, frame);
+      }
+    }
+
+    if (atomic_exchange(&emulation.stats_fresh, false)) {
+      SDL_LockMutex(emulation.stats_lock);
+      SDL_SetWindowTitle(window, emulation.stats);
+      SDL_UnlockMutex(emulation.stats_lock);
+    }
+  }
+
+  atomic_store(&emulation.quit, true);
+  SDL_SemPost(emulation.wake);
+  SDL_WaitThread(thread, NULL);
+  SDL_DestroyMutex(emulation.stats_lock);
+  SDL_DestroySemaphore(emulation.wake);
+  log_flusher_stop(&log_flusher);
+
+  if (record_name) {
+    if (!movie_save(&movie, record_name)) {
+      printf("Failed to save movie to %s\n", record_name);
     }
-    // Set rate to a certain hz
-    SDL_Delay(DELAY_RATE);
+    movie_free(&movie);
+  }
+
+  if (capture_name) {
+    finish_capture(&capture);
   }
 
+  if (netplay_peer) {
+    printf("Netplay: %lu rollbacks, %lu frames resimulated, %lu stalls\n",
+           netplay.rollbacks, netplay.resimulated, netplay.stalls);
+    netplay_close(&netplay);
+  }
+
+  SDL_CloseAudioDevice(audio);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
@@ -71,305 +375,360 @@ int main() {
   return 0;
 }
 
-void initialize() {
-  ch8 = (ch8_t) {0}; // Set everything to zero.
-
-  ch8.pc = 0x200; // Program counter starts at where the rom is to be loaded.
-  ch8.opcode = 0;
-  ch8.I = 0;
-  ch8.sp = 0;
-
-  // Fontset loading
-  for (int i = 0; i < 80; i++) { // TODO: multigesture has pre-increment but seems like it should be post ??? 
-    ch8.memory[i] = chip8_fontset[i];
-  }
-} /* initialize() */
-
 /*
- *  Loads rom of given rom name.
+ *  Emulation thread: runs the machine at 60 frames a second, or flat out in
+ *  turbo, publishing each presented frame to the triple buffer.
  */
 
-bool load_rom(char *rom_name) {
-  
-  FILE *rom = 0;
-  rom = fopen(rom_name, "rb");
+int emulation_thread(void *data) {
+  (void) data;
+  static ch8_snapshot_t snapshot;
+  frame_pacer_t pacer;
+  bool draw_flag = false;
+  unsigned char reported_faults = 0;
+  unsigned long frame_count = 0;
+  bool reported_mismatch = false;
 
-  if (!rom) {
-    return false;
+  pacer_init(&pacer, false);
+  if (emulation.runahead > 0) {
+    snapshot_init(&snapshot, &ch8);
   }
 
-  fread(ch8.memory + 0x200, RAM_SIZE - 0x200, 1, rom);
-
-  return true;
-} /* load_rom() */
+  while (!atomic_load(&emulation.quit)) {
+    if (atomic_load(&emulation.paused)) {
+      // Hand the machine to the debugger until it's done with it.
+      atomic_store(&emulation.parked, true);
+      while (atomic_load(&emulation.paused) &&
+             !atomic_load(&emulation.quit)) {
+        SDL_Delay(1);
+      }
+      atomic_store(&emulation.parked, false);
+      pacer_resync(&pacer);
+      continue;
+    }
 
-/*
- *  Completes one cycle (reads in one opcode) of the emulation.
- */
+    bool turbo = atomic_load(&emulation.turbo);
+    Uint64 present_at = SDL_GetPerformanceCounter() + pacer.freq / FRAME_RATE;
+    int frames = 0;
+
+    if (emulation.netplay) {
+      // A stalled frame still waits out its 1/60th, giving the peer time
+      // to catch up.
+      frames = netplay_advance(emulation.netplay,
+                               atomic_load(&emulation.keys), SDL_GetTicks(),
+                               &draw_flag);
+      if (emulation.netplay->mismatch && !reported_mismatch) {
+        printf("Netplay peer is running a different rom or seed\n");
+        reported_mismatch = true;
+      }
+    } else {
+      // In turbo, run emulated frames back to back until the next present
+      // is due, either after frameskip frames or 1/60th of a second of host
+      // time.
+      do {
+        uint16_t keys = atomic_load(&emulation.keys);
+        set_keys(&ch8, keys);
+        run_frame(&ch8, &draw_flag);
+        // Replay only runs whole frames, so the recording ends before one
+        // a debugger stop cut short, or when it runs out of memory.
+        if (emulation.movie &&
+            (ch8.stopped ||
+             !movie_record_frame(emulation.movie, keys, &ch8))) {
+          printf("Recording stopped after %u frames\n",
+                 emulation.movie->frames);
+          emulation.movie = NULL;
+        }
+        frames++;
+      } while (turbo && !ch8.stopped &&
+               (emulation.frameskip > 0
+                  ? frames < emulation.frameskip
+                  : SDL_GetPerformanceCounter() < present_at));
+    }
+    pacer.emulated += frames;
+    frame_count += frames;
 
-void emulate_cycle(bool *draw_flag) {
+    SDL_LockAudioDevice(emulation.audio);
+    copy_sound(&emulation.sound, &ch8);
+    SDL_UnlockAudioDevice(emulation.audio);
 
-  ch8.opcode = ch8.memory[ch8.pc] << 8 | ch8.memory[ch8.pc + 1]; // Get opcode
+    if (ch8.stopped) {
+      debug_stopped(&debugger, &ch8);
+      ch8.stopped = STOP_NONE;
+      atomic_store(&emulation.paused, true);
+    }
 
-  ch8.pc += 2; // Move to the next instruction.
+    if (ch8.faults != reported_faults) {
+      printf("Fault: %s (first at 0x%03X)\n",
+             fault_string(ch8.faults & ~reported_faults), ch8.fault_pc);
+      reported_faults = ch8.faults;
+    }
 
-  switch(ch8.opcode & 0xF000) {
-    case 0x0000:
-      switch(ch8.opcode & 0x000F) {
-        case 0x0000: // 0x00E0: Clears the screen
-          // TODO: See if this can be optimized.
-          for (int i = 0;  i < (DISPLAY_WIDTH * DISPLAY_HEIGHT); i++) {
-            ch8.gfx[i] = 0;
-          }
-          break;
+    // Each pass is one presented frame, whether or not the screen changed,
+    // so the capture keeps real time.
+    if (emulation.capture) {
+      capture_frame(emulation.capture, &ch8, false);
+    }
 
-        case 0x000E: // 0x00EE: Returns from subroutine
-          ch8.sp--;
-          ch8.pc = ch8.stack[ch8.sp];
-          break;
+    // Run ahead: present where the current input leads a few frames from
+    // now, then go back to the real machine. Not in turbo, where it can't
+    // help, or with a debugger attached, which would stop in the future.
+    // Frames that will be thrown away don't log.
+    bool run_ahead = (emulation.runahead > 0) && !turbo && !ch8.halted &&
+                     !ch8.breakpoints && !ch8.watchpoints &&
+                     !atomic_load(&emulation.paused);
+    if (run_ahead) {
+      snapshot_save(&snapshot, &ch8);
+      ch8.log = NULL;
+      for (int i = 0; (i < emulation.runahead) && !ch8.halted; i++) {
+        run_frame(&ch8, &draw_flag);
+      }
+    }
 
-        default:
-          printf("Unknown opcode \"0x0000\": 0x%x\n", ch8.opcode);
+    // Wake the main thread, unless it hasn't taken the last frame yet.
+    if (draw_flag) {
+      triple_publish(&emulation.frames, &ch8, frame_count);
+      draw_flag = false;
+      if (!atomic_exchange(&emulation.frame_pending, true)) {
+        SDL_Event event = { .type = emulation.frame_event };
+        SDL_PushEvent(&event);
       }
-      break;
+    }
 
-    case 0x1000: // 0x1NNN: Jump, setting the PC to NNN
-      ch8.pc = ch8.opcode & 0x0FFF;
-      break;
+    if (run_ahead) {
+      snapshot_restore(&snapshot, &ch8); // Log included
+    }
 
-    case 0x2000: // 0x2NNN: Push PC to stack and then set PC to NNN
-      ch8.stack[ch8.sp] = ch8.pc;
-      ch8.sp++;
-      break;
+    // Frames that must run one by one, being recorded, captured or sent
+    // to a peer, or that could hit a breakpoint, rule out sleeping.
+    bool idle = !turbo && !emulation.movie && !emulation.capture &&
+                !emulation.netplay && !ch8.breakpoints && !ch8.watchpoints &&
+                machine_idle(&ch8);
+    if (turbo) {
+      pacer_resync(&pacer);
+    } else if (idle) {
+      idle_sleep(&pacer);
+    } else {
+      pacer_wait(&pacer);
+    }
 
-    case 0x3000: // 0x3XNN: Skip an instruction if VX is equal to NN
-      if (ch8.V[(ch8.opcode & 0x0F00) >> 8] == (ch8.opcode & 0x00FF)) {
-        ch8.pc += 2;
+    char stats[128];
+    if (pacer_report(&pacer, stats, sizeof(stats))) {
+      SDL_LockMutex(emulation.stats_lock);
+      memcpy(emulation.stats, stats, sizeof(stats));
+      SDL_UnlockMutex(emulation.stats_lock);
+      atomic_store(&emulation.stats_fresh, true);
+      if (emulation.print_stats) {
+        printf("%s\n", stats);
       }
-      break;
+    }
+  }
 
-    case 0x4000: // 0x4XNN Skip an instruction if VX is not equal to NN
-      if (ch8.V[(ch8.opcode & 0x0F00) >> 8] != (ch8.opcode & 0x00FF)) {
-        ch8.pc += 2;
-      }
-      break;
+  return 0;
+} /* emulation_thread() */
 
-    case 0x5000: // 0x5XY0: Skips an instruction if VX and VY are equal
-      if (ch8.V[(ch8.opcode & 0x0F00) >> 8] ==
-          ch8.V[(ch8.opcode & 0x00F0) >> 4]) {
-        ch8.pc += 2;
-      }
-      break;
+/*
+ *  Sleeps while the machine is idle, until the keys change, quit or the
+ *  debugger wants the thread, or a sound that's playing is due to stop.
+ *  The frames slept through would only have ticked the timers, so that's
+ *  all that's done for them.
+ */
 
-    case 0x6000: // 0x6XNN: Set the register VX to NN
-      ch8.V[(ch8.opcode & 0x0F00) >> 8] = ch8.opcode & 0x00FF; 
-      break;
+void idle_sleep(frame_pacer_t *pacer) {
+  // Compared with the keys the machine last saw, so a change that came in
+  // since they were set isn't taken as the baseline and slept through
+  uint16_t keys = get_keys(&ch8);
+  Uint64 start = SDL_GetPerformanceCounter();
+  Uint32 timeout = MAX_IDLE_MS;
+  unsigned char sound = get_sound_timer(&ch8);
 
-    case 0x7000: // 0x7XNN: Add NN to register VX 
-      ch8.V[(ch8.opcode & 0x0F00) >> 8] += ch8.opcode & 0x00FF; 
+  if (sound > 0) {
+    timeout = sound * 1000 / FRAME_RATE;
+  }
+
+  while ((atomic_load(&emulation.keys) == keys) &&
+         !atomic_load(&emulation.quit) && !atomic_load(&emulation.paused)) {
+    Uint32 slept = (SDL_GetPerformanceCounter() - start) * 1000 / pacer->freq;
+    if ((slept >= timeout) ||
+        (SDL_SemWaitTimeout(emulation.wake, timeout - slept) ==
+         SDL_MUTEX_TIMEDOUT)) {
       break;
+    }
+  }
 
-    case 0x8000:
-      switch(ch8.opcode & 0x000F) {
-        case 0x0000: // 0x8XY0: Set VX to VY
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] =
-            ch8.V[(ch8.opcode & 0x00F0) >> 4];
-          break;
-
-        case 0x0001: // 0x8XY1: Set VX to binary or of VX and VY
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] |=
-            ch8.V[(ch8.opcode & 0x00F0) >> 4];
-          break;
-
-        case 0x0002: // 0x8XY2: Set VX to binary and of VX and VY
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] &=
-            ch8.V[(ch8.opcode & 0x00F0) >> 4];
-          break;
-
-        case 0x0003: // 0x8XY3: Set VX to binary xor of VX and VY
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] ^=
-            ch8.V[(ch8.opcode & 0x00F0) >> 4];
-          break;
-
-        case 0x0004: // 0x8XY4: Set VX to VX plus VY
-          ch8.V[0xF] = 0;
-          if ((ch8.V[(ch8.opcode & 0x0F00) >> 8] +
-              ch8.V[(ch8.opcode & 0x00F0) >> 4]) > 255) {
-            ch8.V[0xF] = 1;
-          }
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] +=
-            ch8.V[(ch8.opcode & 0x00F0) >> 4];
-          break;
-
-        case 0x0005: // 0x8XY5: VX is VX - VY
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] -=
-            ch8.V[(ch8.opcode & 0x00F0) >> 4];
-
-          ch8.V[0xF] = 1;
-
-          if (ch8.V[(ch8.opcode & 0x0F00) >> 8] <
-              ch8.V[(ch8.opcode & 0x00F0) >> 4]) {
-            ch8.V[0xF] = 0;
-          }
-          break;
-
-        case 0x0006: // 0x8XY6: Shift VX one bit to the right
-          ch8.V[0xF] = 0;
-          if (ch8.V[(ch8.opcode & 0x0F00) >> 8] & 0x1) {
-            ch8.V[0xF] = 1;
-          }
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] =
-            (ch8.V[(ch8.opcode & 0x0F00) >> 8] >> 1);
-          break;
-
-        case 0x0007: // 0x8XY5: VX is VY - VX
-          ch8.V[(ch8.opcode & 0x00F0) >> 4] -=
-            ch8.V[(ch8.opcode & 0x0F00) >> 8];
-
-          ch8.V[0xF] = 1;
-
-          if (ch8.V[(ch8.opcode & 0x0F00) >> 8] >
-              ch8.V[(ch8.opcode & 0x00F0) >> 4]) {
-            ch8.V[0xF] = 0;
-          }
-          break;
-
-        case 0x000E: /// 0x8XY6: Shift VX 1 bit left
-          ch8.V[0xF] = 0;
-          // TODO: Check this for bugs :)
-          if (ch8.V[(ch8.opcode & 0x0F00) >> 8] >> 3) {
-            ch8.V[0xF] = 1;
-          }
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] =
-            (ch8.V[(ch8.opcode & 0x0F00) >> 8] << 1);
-          break;
-
-        default:
-          printf("Unknown opcode \"0x8000\": 0x%x\n", ch8.opcode);
-      }
+  Uint64 frames = (SDL_GetPerformanceCounter() - start) * FRAME_RATE /
+                  pacer->freq;
+  for (Uint64 i = 0; i < frames; i++) {
+    tick_timers(&ch8);
+  }
+  pacer->emulated += frames;
+  pacer_resync(pacer);
+} /* idle_sleep() */
 
-    case 0x9000: // 0x9XY0: Skips an instruction if VX and VY are not equal
-      if (ch8.V[(ch8.opcode & 0x0F00) >> 8] !=
-          ch8.V[(ch8.opcode & 0x00F0) >> 4]) {
-        ch8.pc += 2;
-      }
-      break;
+/*
+ *  Replays a recorded movie without opening a window, checking that it
+ *  produces the same frames. Returns the process exit status.
+ */
 
-    case 0xA000: // 0xANNN: Set index register ch8.I to NNN
-      ch8.I = ch8.opcode & 0x0FFF;
-      break;
+int replay(const char *rom_name, const char *movie_name) {
+  movie_t movie;
 
-    case 0xB000: // 0xBNNN: Jump with offset
-      ch8.pc = ch8.memory[(ch8.opcode & 0x0FFF) +
-               (ch8.V[(ch8.opcode & 0x0F00) >> 8])];
-      break;
+  if (!movie_load(&movie, movie_name)) {
+    printf("Failed to load movie %s\n", movie_name);
+    return 1;
+  }
 
-    case 0xC000: // 0xCXNN: Generates random number
+  initialize(&ch8, movie.seed);
+  ch8.fault_policy = movie.fault_policy;
+  if (!load_rom(&ch8, rom_name)) {
+    printf("Failed to load rom! Exiting...\n");
+    movie_free(&movie);
+    return 1;
+  }
 
-      // Seed the random number.
-      srand(time(0));
+  log_init(&machine_log);
+  ch8.log = &machine_log;
+  long mismatch = movie_replay(&movie, &ch8);
+  log_drain(&machine_log, stdout);
+  if (mismatch == 0) {
+    printf("Movie was recorded with a different rom or configuration\n");
+  } else if (mismatch > 0) {
+    printf("Replay diverged by frame %ld\n", mismatch);
+  } else {
+    printf("Replayed %u frames, %u checkpoints matched\n", movie.frames,
+           movie.checkpoint_count);
+  }
 
-      ch8.V[(ch8.opcode & 0x0F00) >> 8] = (rand() & (ch8.opcode & 0x00FF));
-      break;
+  movie_free(&movie);
+  return mismatch == -1 ? 0 : 1;
+} /* replay() */
 
-    case 0xD000: { // 0xDXYN: Draws sprites to screen.
-      // TODO: Rewrite this code in my own way.
-      unsigned short x = ch8.V[(ch8.opcode & 0x0F00) >> 8] % 64;
-      unsigned short y = ch8.V[(ch8.opcode & 0x00F0) >> 4] % 32;
-      unsigned short height = ch8.opcode & 0x000F;
-      unsigned short pixel = 0;
-
-      ch8.V[0xF] = 0;
-
-      for (int i = 0; i < height; i++) {
-        pixel = ch8.memory[ch8.I + i];
-        
-        for (int j = 0; j < 8; j++) {
-          if ((pixel & (0x80 >> j)) != 0) {
-            if (ch8.gfx[(x + j + ((y + i) * 64))] == 1) {
-              ch8.V[0xF] = 1;
-            }
-            ch8.gfx[x + j + ((y + i) * 64)] ^= 1;
-          }
-        }
-      }
-      *draw_flag = true;
-      break;
-    }
+/*
+ *  Runs a rom for a number of frames as fast as possible without opening a
+ *  window, capturing every frame if a capture name is given. Returns the
+ *  process exit status.
+ */
 
-    case 0xE000: {
-      switch(ch8.opcode & 0x000F) {
-        case 0x000E: // 0xEX9E
-          break;
-        case 0x0001: // 0xEXA1
-          break;
-      }
-      break;
-    }
+int headless(const char *rom_name, uint32_t seed, long frames,
+             const char *capture_name, int scale, bool check) {
+  capture_t capture;
+  bool draw_flag = false;
 
-    case 0xF000: { //TODO: Label what each opcode does.
-      switch (ch8.opcode & 0x00FF) {
-        case 0x0007: // 0xFX07: VX becomes current value of timer
-          ch8.V[(ch8.opcode & 0x0F00) >> 8] = ch8.delay_timer;
-          break;
-
-        case 0x0015: // 0xFX15: Sets delay timer to VX
-          ch8.delay_timer = ch8.V[(ch8.opcode & 0x0F00) >> 8];
-          break;
-
-        case 0x0018: // 0xFX18: Sets sound timer to VX
-          ch8.sound_timer = ch8.V[(ch8.opcode & 0x0F00) >> 8];
-          break;
-
-        case 0x001E: // 0xFX1E: Add VX to index register I
-          ch8.I += ch8.V[(ch8.opcode & 0x0F00) >> 8];
-          break;
-
-        case 0x0033: { // 0xFX33: "Binary-coded decimal conversion"
-          unsigned char num = ch8.V[(ch8.opcode & 0x0F00) >> 8];
-          ch8.memory[ch8.I] = num / 100; // Get hundreds place
-          ch8.memory[ch8.I + 1] = (num % 100) / 10; // Get tens place
-          ch8.memory[ch8.I + 2] = (num % 10); // Get ones place
-          break;
-        }
-      }
-      break;
+  initialize(&ch8, seed);
+  if (!open_rom(rom_name, check)) {
+    return 1;
+  }
+
+  if (capture_name && !capture_open(&capture, capture_name, scale,
+                                    palette)) {
+    printf("Can't capture to %s\n", capture_name);
+    return 1;
+  }
+
+  // No flusher thread here, the log is drained after each frame instead.
+  log_init(&machine_log);
+  ch8.log = &machine_log;
+
+  for (long i = 0; (i < frames) && !ch8.halted; i++) {
+    run_frame(&ch8, &draw_flag);
+    log_drain(&machine_log, stdout);
+    if (capture_name) {
+      // Nothing needs to keep real time here, so wait out a full queue
+      // instead of dropping frames.
+      capture_frame(&capture, &ch8, true);
     }
+  }
 
-    default:
-      printf("Unknown opcode: 0x%x\n", ch8.opcode);
+  if (capture_name) {
+    finish_capture(&capture);
   }
+  return 0;
+} /* headless() */
+
+/*
+ *  Loads a rom into the machine. With check, the rom is scanned first and
+ *  the findings printed, and a rom that's too big or reaches an unknown
+ *  opcode is refused.
+ */
+
+bool open_rom(const char *rom_name, bool check) {
+  rom_scan_t scan;
 
-  // Deincrement timers if necessary
-  if (ch8.delay_timer > 0) {
-    ch8.delay_timer--;
+  if (!check) {
+    if (!load_rom(&ch8, rom_name)) {
+      printf("Failed to load rom! Exiting...\n");
+      return false;
+    }
+    return true;
+  }
+
+  bool ok = load_rom_checked(&ch8, rom_name, &scan);
+  if (!ok && (scan.reachable == 0) && !scan.too_big) { // Unreadable
+    printf("Failed to load rom! Exiting...\n");
+    return false;
   }
+  scan_print(&scan, stdout);
+  if (!ok) {
+    printf("Rom rejected! Exiting...\n");
+  }
+  return ok;
+} /* open_rom() */
+
+/*
+ *  Flushes a capture and reports how it went.
+ */
 
-  if (ch8.sound_timer > 0) {
-    beep();
-    ch8.sound_timer--;
+void finish_capture(capture_t *capture) {
+  capture_close(capture);
+  printf("Captured %lu frames to %s", capture->frames, capture->name);
+  if (capture->dropped) {
+    printf(", dropped %lu", capture->dropped);
   }
-} /* emulateCycle() */
+  printf("%s\n", capture->failed ? ", write failed" : "");
+} /* finish_capture() */
 
 /*
- *  Draws to the surface.
+ *  Draws a frame to the surface.
  */
 
-void draw(SDL_Renderer **renderer) {
+void draw(SDL_Renderer **renderer, const frame_t *frame) {
 
   // Clear the screen
   SDL_SetRenderDrawColor(*renderer, 0, 0, 0, 0);
   SDL_RenderClear(*renderer);
 
-  // Draw the graphics
-  SDL_SetRenderDrawColor(*renderer, 255, 0, 255, 255);
-  for (int x = 0; x < DISPLAY_WIDTH * DISPLAY_SCALE; x++) {
-    for (int y = 0; y < DISPLAY_HEIGHT * DISPLAY_SCALE; y++) {
-      if (ch8.gfx[(x/DISPLAY_SCALE) + (y/DISPLAY_SCALE) * 64] == 1) {
-        SDL_RenderDrawPoint(*renderer, x, y);
+  int width = frame->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+  int height = frame->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+  int words = width / 64;
+  int scale = (DISPLAY_WIDTH * DISPLAY_SCALE) / width;
+
+  // Draw the graphics, one rectangle per horizontal run of the same color.
+  // The color is the combination of the bits of both planes.
+  for (int y = 0; y < height; y++) {
+    int run_start = 0;
+    int run_color = 0;
+    for (int x = 0; x <= width; x++) {
+      int color = 0;
+      if (x < width) {
+        for (int p = 0; p < GFX_PLANES; p++) {
+          color |= ((frame->gfx[p][y * words + x / 64] >> (63 - x % 64)) &
+                    1) << p;
+        }
+      }
+
+      if (color != run_color || x == width) {
+        if (run_color != 0) {
+          SDL_SetRenderDrawColor(*renderer, palette[run_color][0],
+                                 palette[run_color][1],
+                                 palette[run_color][2], 255);
+          SDL_Rect rect = { run_start * scale, y * scale,
+                            (x - run_start) * scale, scale };
+          SDL_RenderFillRect(*renderer, &rect);
+        }
+        run_start = x;
+        run_color = color;
       }
     }
-  } 
+  }
   SDL_RenderPresent(*renderer); // Display the changes
 } /* draw() */
 
@@ -380,22 +739,61 @@ void draw(SDL_Renderer **renderer) {
 void handle_input(SDL_Event *event) {
   switch((*event).type) {
     case SDL_KEYDOWN:
-      printf("Key down!\n");
+      log_event(&input_log, LOG_KEY_DOWN, 0, (*event).key.keysym.sym, 0);
       break;
 
     case SDL_KEYUP:
-      printf("Key up!\n");
+      log_event(&input_log, LOG_KEY_UP, 0, (*event).key.keysym.sym, 0);
       break;
 
     default:
-      break;
+      return;
+  }
+
+  // The emulation thread picks the mask up at the start of its next frame,
+  // waking first if it's idle.
+  for (int i = 0; i < 16; i++) {
+    if ((*event).key.keysym.sym == keymap[i]) {
+      if ((*event).type == SDL_KEYDOWN) {
+        atomic_fetch_or(&emulation.keys, 1u << i);
+      } else {
+        atomic_fetch_and(&emulation.keys, ~(1u << i));
+      }
+      SDL_SemPost(emulation.wake);
+    }
   }
 }
 
 /*
- *  Emits beeping noise on the system.
+ *  Copies what the audio callback needs out of the machine.
  */
 
-void beep() {
-  printf("Beep!\n");
-} /* beep() */
+void copy_sound(sound_t *sound, const ch8_t *machine) {
+  sound->playing = get_sound_timer(machine) > 0;
+  sound->pitch = machine->pitch;
+  memcpy(sound->pattern, machine->pattern, AUDIO_PATTERN_SIZE);
+} /* copy_sound() */
+
+/*
+ *  Fills the SDL audio buffer by playing back the 1-bit sample pattern at the
+ *  rate selected by the pitch register, 4000*2^((pitch-64)/48) bits a second.
+ *  SDL holds the audio device lock while this runs.
+ */
+
+void audio_callback(void *userdata, Uint8 *stream, int len) {
+  static double position = 0; // Bit position into the pattern
+
+  const sound_t *sound = userdata;
+  double rate = 4000 * pow(2.0, (sound->pitch - 64) / 48.0) / AUDIO_FREQ;
+
+  for (int i = 0; i < len; i++) {
+    int bit = (int) position % (AUDIO_PATTERN_SIZE * 8);
+    bool high = (sound->pattern[bit / 8] >> (7 - bit % 8)) & 1;
+
+    stream[i] = 128;
+    if (sound->playing) {
+      stream[i] = high ? 160 : 96;
+    }
+    position = fmod(position + rate, AUDIO_PATTERN_SIZE * 8);
+  }
+} /* audio_callback() */
@@ -1,42 +1,25 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-#define RAM_SIZE (4096)
+#include "chip8.h"
 
-#define DISPLAY_WIDTH (64)
-#define DISPLAY_HEIGHT (32)
+#include "include/SDL2/SDL_keycode.h"
 
-typedef struct chip_8 {
-  unsigned short opcode;
-  unsigned char memory[RAM_SIZE];
-  unsigned char V[16];
-  unsigned short I;
-  unsigned short pc;
-  unsigned char gfx[DISPLAY_WIDTH * DISPLAY_HEIGHT];
-  unsigned char delay_timer;
-  unsigned char sound_timer;
-  unsigned short stack[16];
-  unsigned short sp;
-  unsigned char key[16];
-} ch8_t;
+#define DISPLAY_SCALE (20)
+#define AUDIO_FREQ (44100)
+#define MAX_RUNAHEAD (8) // Frames --runahead can hide
+#define MAX_IDLE_MS (500) // Longest an idle machine sleeps between checks
 
-const unsigned char chip8_fontset[80] = {
-  0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-  0x20, 0x60, 0x20, 0x20, 0x70, // 1
-  0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-  0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-  0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-  0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-  0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-  0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-  0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-  0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-  0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-  0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-  0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-  0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-  0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-  0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+// Host keys for the CHIP-8 keypad, laid out as the 4x4 block under 1-4:
+//   1 2 3 C      1 2 3 4
+//   4 5 6 D      Q W E R
+//   7 8 9 E  ->  A S D F
+//   A 0 B F      Z X C V
+const SDL_Keycode keymap[16] = {
+  SDLK_x, SDLK_1, SDLK_2, SDLK_3, // 0 1 2 3
+  SDLK_q, SDLK_w, SDLK_e, SDLK_a, // 4 5 6 7
+  SDLK_s, SDLK_d, SDLK_z, SDLK_c, // 8 9 A B
+  SDLK_4, SDLK_r, SDLK_f, SDLK_v  // C D E F
 };
 
 #endif
@@ -0,0 +1,271 @@
+#include "movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool write_u16(FILE *, uint16_t);
+static bool write_u32(FILE *, uint32_t);
+static bool write_u64(FILE *, uint64_t);
+static bool read_u16(FILE *, uint16_t *);
+static bool read_u32(FILE *, uint32_t *);
+static bool read_u64(FILE *, uint64_t *);
+
+/*
+ *  Starts an empty recording for a machine that has just been initialized
+ *  with the given seed, given its fault policy and had its rom loaded.
+ */
+
+void movie_init(movie_t *movie, const ch8_t *ch8, uint32_t seed) {
+  *movie = (movie_t) {0};
+
+  movie->seed = seed;
+  movie->fault_policy = ch8->fault_policy;
+  movie->cycles_per_frame = CYCLES_PER_FRAME;
+  movie->rom_hash = memory_hash(ch8);
+  movie->interval = CHECKPOINT_INTERVAL;
+} /* movie_init() */
+
+/*
+ *  Appends one frame that ran with the given keypad state, leaving ch8 in the
+ *  state it's in now. Returns false, leaving the movie as it was, if there's
+ *  no memory for it.
+ */
+
+bool movie_record_frame(movie_t *movie, uint16_t keys, const ch8_t *ch8) {
+  movie_run_t *last = movie->run_count ? movie->runs + movie->run_count - 1
+                                        : NULL;
+  bool extend = last && (last->keys == keys) && (last->length < UINT16_MAX);
+  bool checkpoint = (movie->frames + 1) % movie->interval == 0;
+
+  // Grow both arrays before touching either, so a failure records nothing.
+  if (!extend && (movie->run_count == movie->run_capacity)) {
+    uint32_t capacity = movie->run_capacity ? movie->run_capacity * 2 : 64;
+    movie_run_t *runs = realloc(movie->runs, capacity * sizeof(movie_run_t));
+    if (!runs) {
+      return false;
+    }
+    movie->runs = runs;
+    movie->run_capacity = capacity;
+  }
+  if (checkpoint && (movie->checkpoint_count == movie->checkpoint_capacity)) {
+    uint32_t capacity = movie->checkpoint_capacity ?
+                        movie->checkpoint_capacity * 2 : 64;
+    uint64_t *checkpoints = realloc(movie->checkpoints,
+                                    capacity * sizeof(uint64_t));
+    if (!checkpoints) {
+      return false;
+    }
+    movie->checkpoints = checkpoints;
+    movie->checkpoint_capacity = capacity;
+  }
+
+  if (extend) {
+    last->length++;
+  } else {
+    movie->runs[movie->run_count++] = (movie_run_t) { keys, 1 };
+  }
+
+  movie->frames++;
+  if (checkpoint) {
+    movie->checkpoints[movie->checkpoint_count++] = gfx_hash(ch8);
+  }
+  return true;
+} /* movie_record_frame() */
+
+/*
+ *  Writes the movie to a file, all fields little endian.
+ */
+
+bool movie_save(const movie_t *movie, const char *file_name) {
+  FILE *file = fopen(file_name, "wb");
+
+  if (!file) {
+    return false;
+  }
+
+  bool ok = fwrite(MOVIE_MAGIC, 4, 1, file) == 1;
+  ok = ok && write_u16(file, MOVIE_VERSION);
+  ok = ok && write_u16(file, movie->cycles_per_frame);
+  ok = ok && write_u32(file, movie->seed);
+  ok = ok && write_u16(file, movie->fault_policy);
+  ok = ok && write_u64(file, movie->rom_hash);
+  ok = ok && write_u32(file, movie->frames);
+  ok = ok && write_u32(file, movie->interval);
+
+  ok = ok && write_u32(file, movie->run_count);
+  for (uint32_t i = 0; ok && (i < movie->run_count); i++) {
+    ok = write_u16(file, movie->runs[i].keys) &&
+         write_u16(file, movie->runs[i].length);
+  }
+
+  ok = ok && write_u32(file, movie->checkpoint_count);
+  for (uint32_t i = 0; ok && (i < movie->checkpoint_count); i++) {
+    ok = write_u64(file, movie->checkpoints[i]);
+  }
+
+  return (fclose(file) == 0) && ok;
+} /* movie_save() */
+
+/*
+ *  Reads a movie written by movie_save().
+ */
+
+bool movie_load(movie_t *movie, const char *file_name) {
+  FILE *file = fopen(file_name, "rb");
+  char magic[4];
+  uint16_t version = 0;
+
+  *movie = (movie_t) {0};
+  if (!file) {
+    return false;
+  }
+
+  bool ok = (fread(magic, 4, 1, file) == 1) &&
+            (memcmp(magic, MOVIE_MAGIC, 4) == 0);
+  ok = ok && read_u16(file, &version) && (version >= 1) &&
+       (version <= MOVIE_VERSION);
+  ok = ok && read_u16(file, &movie->cycles_per_frame);
+  ok = ok && read_u32(file, &movie->seed);
+  movie->fault_policy = FAULT_REPORT;
+  if (version >= 2) {
+    ok = ok && read_u16(file, &movie->fault_policy) &&
+         (movie->fault_policy <= FAULT_HALT);
+  }
+  ok = ok && read_u64(file, &movie->rom_hash);
+  ok = ok && read_u32(file, &movie->frames);
+  ok = ok && read_u32(file, &movie->interval) && (movie->interval > 0);
+
+  // Every run is at least a frame long and checkpoints come every interval,
+  // so counts past that are corrupt, and they're checked before sizing
+  // anything by them
+  ok = ok && read_u32(file, &movie->run_count) &&
+       (movie->run_count <= movie->frames);
+  if (ok) {
+    movie->run_capacity = movie->run_count;
+    movie->runs = calloc((size_t) movie->run_count + 1, sizeof(movie_run_t));
+    ok = movie->runs != NULL;
+  }
+  for (uint32_t i = 0; ok && (i < movie->run_count); i++) {
+    ok = read_u16(file, &movie->runs[i].keys) &&
+         read_u16(file, &movie->runs[i].length);
+  }
+
+  ok = ok && read_u32(file, &movie->checkpoint_count) &&
+       (movie->checkpoint_count <= movie->frames / movie->interval);
+  if (ok) {
+    movie->checkpoint_capacity = movie->checkpoint_count;
+    movie->checkpoints = calloc((size_t) movie->checkpoint_count + 1,
+                                sizeof(uint64_t));
+    ok = movie->checkpoints != NULL;
+  }
+  for (uint32_t i = 0; ok && (i < movie->checkpoint_count); i++) {
+    ok = read_u64(file, &movie->checkpoints[i]);
+  }
+
+  fclose(file);
+  if (!ok) {
+    movie_free(movie);
+  }
+  return ok;
+} /* movie_load() */
+
+/*
+ *  Replays a movie on a machine that has been initialized with the movie's
+ *  seed and fault policy and had the same rom loaded, without drawing
+ *  anything. Returns -1 if
+ *  every checkpoint matched, otherwise the frame the first mismatch was found
+ *  at (0 meaning the machine doesn't match the recording's setup).
+ */
+
+long movie_replay(const movie_t *movie, ch8_t *ch8) {
+  if ((movie->rom_hash != memory_hash(ch8)) ||
+      (movie->fault_policy != ch8->fault_policy) ||
+      (movie->cycles_per_frame != CYCLES_PER_FRAME)) {
+    return 0;
+  }
+
+  bool draw_flag = false;
+  uint32_t frame = 0;
+  uint32_t checkpoint = 0;
+
+  for (uint32_t i = 0; i < movie->run_count; i++) {
+    set_keys(ch8, movie->runs[i].keys);
+
+    for (int j = 0; j < movie->runs[i].length; j++) {
+      run_frame(ch8, &draw_flag);
+      frame++;
+
+      if ((frame % movie->interval == 0) &&
+          (checkpoint < movie->checkpoint_count) &&
+          (movie->checkpoints[checkpoint++] != gfx_hash(ch8))) {
+        return frame;
+      }
+    }
+  }
+  return -1;
+} /* movie_replay() */
+
+/*
+ *  Frees the run and checkpoint buffers.
+ */
+
+void movie_free(movie_t *movie) {
+  free(movie->runs);
+  free(movie->checkpoints);
+  *movie = (movie_t) {0};
+} /* movie_free() */
+
+/*
+ *  Hashes the whole address space, identifying the rom a recording was made
+ *  with independently of its file.
+ */
+
+uint64_t memory_hash(const ch8_t *ch8) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+
+  for (size_t i = 0; i < RAM_SIZE; i++) {
+    hash = (hash ^ ch8->memory[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+} /* memory_hash() */
+
+static bool write_u16(FILE *file, uint16_t value) {
+  unsigned char bytes[2] = { value & 0xFF, value >> 8 };
+  return fwrite(bytes, sizeof(bytes), 1, file) == 1;
+}
+
+static bool write_u32(FILE *file, uint32_t value) {
+  return write_u16(file, value & 0xFFFF) && write_u16(file, value >> 16);
+}
+
+static bool write_u64(FILE *file, uint64_t value) {
+  return write_u32(file, value & 0xFFFFFFFF) && write_u32(file, value >> 32);
+}
+
+static bool read_u16(FILE *file, uint16_t *value) {
+  unsigned char bytes[2];
+  if (fread(bytes, sizeof(bytes), 1, file) != 1) {
+    return false;
+  }
+  *value = bytes[0] | (bytes[1] << 8);
+  return true;
+}
+
+static bool read_u32(FILE *file, uint32_t *value) {
+  uint16_t low, high;
+  if (!read_u16(file, &low) || !read_u16(file, &high)) {
+    return false;
+  }
+  *value = low | ((uint32_t) high << 16);
+  return true;
+}
+
+static bool read_u64(FILE *file, uint64_t *value) {
+  uint32_t low, high;
+  if (!read_u32(file, &low) || !read_u32(file, &high)) {
+    return false;
+  }
+  *value = low | ((uint64_t) high << 32);
+  return true;
+}
@@ -0,0 +1,51 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "chip8.h"
+
+#include <stddef.h>
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION (2) // 1 had no fault policy, which was FAULT_REPORT
+#define CHECKPOINT_INTERVAL (60) // Frames between framebuffer hashes
+
+/*
+ *  A movie is the keypad state of every frame of a run, stored as runs of
+ *  identical frames, together with everything else the run depends on: the
+ *  seed, the fault policy, the instructions per frame and a hash of the
+ *  loaded memory.
+ *  Framebuffer hashes are kept every CHECKPOINT_INTERVAL frames so a replay
+ *  can tell where it first diverged.
+ */
+
+typedef struct movie_run {
+  uint16_t keys;
+  uint16_t length;
+} movie_run_t;
+
+typedef struct movie {
+  uint32_t seed;
+  uint16_t fault_policy; // A fault_policy_t
+  uint16_t cycles_per_frame;
+  uint64_t rom_hash;
+  uint32_t frames;
+  uint32_t interval;
+
+  movie_run_t *runs;
+  uint32_t run_count;
+  uint32_t run_capacity;
+
+  uint64_t *checkpoints;
+  uint32_t checkpoint_count;
+  uint32_t checkpoint_capacity;
+} movie_t;
+
+void movie_init(movie_t *, const ch8_t *, uint32_t);
+bool movie_record_frame(movie_t *, uint16_t, const ch8_t *);
+bool movie_save(const movie_t *, const char *);
+bool movie_load(movie_t *, const char *);
+long movie_replay(const movie_t *, ch8_t *);
+void movie_free(movie_t *);
+uint64_t memory_hash(const ch8_t *);
+
+#endif
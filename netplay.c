@@ -0,0 +1,354 @@
+#include "netplay.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SAVE_COUNT (NETPLAY_WINDOW + 1)
+
+static uint16_t remote_input(const netplay_t *, uint32_t);
+static void run_frame_with_inputs(netplay_t *, bool *);
+static void save_frame(netplay_t *, uint32_t);
+static void load_frame(netplay_t *, uint32_t);
+static void send_inputs(netplay_t *, uint32_t);
+static void send_packet(netplay_t *, const unsigned char *, size_t,
+                        uint32_t);
+static void flush_delayed(netplay_t *, uint32_t);
+static uint32_t receive_inputs(netplay_t *);
+static void put_u16(unsigned char *, uint16_t);
+static void put_u32(unsigned char *, uint32_t);
+static uint16_t get_u16(const unsigned char *);
+static uint32_t get_u32(const unsigned char *);
+
+/*
+ *  Starts a session for a machine that has just been initialized and had
+ *  its rom loaded, listening on local_port and sending to host:port.
+ */
+
+bool netplay_open(netplay_t *netplay, ch8_t *machine, uint16_t local_port,
+                  const char *host, uint16_t port) {
+  memset(netplay, 0, sizeof(*netplay));
+  netplay->machine = machine;
+
+  uint64_t hash = state_hash(machine);
+  netplay->session = (uint32_t) (hash ^ (hash >> 32));
+  for (int i = 0; i < SAVE_COUNT; i++) {
+    snapshot_init(&netplay->saves[i], machine);
+  }
+
+  struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+  struct addrinfo *found;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(host, service, &hints, &found) != 0) {
+    return false;
+  }
+  memcpy(&netplay->remote, found->ai_addr, sizeof(netplay->remote));
+  freeaddrinfo(found);
+
+  netplay->socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (netplay->socket < 0) {
+    return false;
+  }
+
+  struct sockaddr_in local = {
+    .sin_family = AF_INET,
+    .sin_port = htons(local_port),
+    .sin_addr.s_addr = htonl(INADDR_ANY)
+  };
+  if ((bind(netplay->socket, (struct sockaddr *) &local, sizeof(local)) < 0) ||
+      (fcntl(netplay->socket, F_SETFL, O_NONBLOCK) < 0)) {
+    close(netplay->socket);
+    return false;
+  }
+
+  return true;
+} /* netplay_open() */
+
+/*
+ *  Delays every outgoing packet by latency milliseconds and drops loss
+ *  percent of them, chosen by a generator seeded with seed.
+ */
+
+void netplay_simulate(netplay_t *netplay, int latency, int loss,
+                      uint32_t seed) {
+  netplay->latency = latency;
+  netplay->loss = loss;
+  netplay->rng = seed ? seed : DEFAULT_SEED;
+} /* netplay_simulate() */
+
+/*
+ *  Sends and receives inputs without running a new frame, rolling back and
+ *  re-simulating if a prediction turned out wrong. Sets *draw_flag if that
+ *  redrew the screen.
+ */
+
+void netplay_poll(netplay_t *netplay, uint32_t now, bool *draw_flag) {
+  flush_delayed(netplay, now);
+  uint32_t first_wrong = receive_inputs(netplay);
+
+  if (first_wrong < netplay->frame) {
+    // Back to the start of the first wrong frame, then forward again with
+    // the inputs as they're now known or predicted.
+    uint32_t present = netplay->frame;
+    load_frame(netplay, first_wrong % SAVE_COUNT);
+    netplay->frame = first_wrong;
+    while (netplay->frame < present) {
+      run_frame_with_inputs(netplay, draw_flag);
+    }
+    netplay->rollbacks++;
+    netplay->resimulated += present - first_wrong;
+  }
+
+  send_inputs(netplay, now);
+} /* netplay_poll() */
+
+/*
+ *  Runs the next frame with the local keys, unless the peer is too far
+ *  behind. Returns whether a frame was run.
+ */
+
+bool netplay_advance(netplay_t *netplay, uint16_t keys, uint32_t now,
+                     bool *draw_flag) {
+  netplay_poll(netplay, now, draw_flag);
+
+  // The peer may also be ahead, so the difference is signed.
+  if ((int32_t) (netplay->frame - netplay->remote_count) >= NETPLAY_WINDOW) {
+    netplay->stalls++;
+    return false;
+  }
+
+  netplay->local_inputs[netplay->frame % NETPLAY_HISTORY] = keys;
+  run_frame_with_inputs(netplay, draw_flag);
+  send_inputs(netplay, now);
+  return true;
+} /* netplay_advance() */
+
+/*
+ *  Closes the socket. Delayed packets still queued are dropped.
+ */
+
+void netplay_close(netplay_t *netplay) {
+  close(netplay->socket);
+  netplay->socket = -1;
+} /* netplay_close() */
+
+/*
+ *  The remote input for a frame: the real one if it has arrived, otherwise
+ *  a prediction that it's the same as the last one that did.
+ */
+
+static uint16_t remote_input(const netplay_t *netplay, uint32_t frame) {
+  if (frame < netplay->remote_count) {
+    return netplay->remote_inputs[frame % NETPLAY_HISTORY];
+  }
+  if (netplay->remote_count == 0) {
+    return 0;
+  }
+  return netplay->remote_inputs[(netplay->remote_count - 1) %
+                                NETPLAY_HISTORY];
+} /* remote_input() */
+
+/*
+ *  Saves the machine at the start of the current frame and runs it with
+ *  both sides' keys.
+ */
+
+static void run_frame_with_inputs(netplay_t *netplay, bool *draw_flag) {
+  uint32_t frame = netplay->frame;
+  uint16_t remote = remote_input(netplay, frame);
+
+  save_frame(netplay, frame % SAVE_COUNT);
+  netplay->predicted[frame % NETPLAY_HISTORY] = remote;
+  set_keys(netplay->machine,
+           netplay->local_inputs[frame % NETPLAY_HISTORY] | remote);
+  run_frame(netplay->machine, draw_flag);
+  netplay->frame++;
+} /* run_frame_with_inputs() */
+
+/*
+ *  Saves the machine in a slot. The snapshots share the machine's dirty
+ *  bits, so each slot keeps its own record of the pages written since it
+ *  was saved, and those are what the snapshot brings up to date.
+ */
+
+static void save_frame(netplay_t *netplay, uint32_t slot) {
+  ch8_t *machine = netplay->machine;
+
+  for (int w = 0; w < RAM_PAGES / 64; w++) {
+    for (int i = 0; i < SAVE_COUNT; i++) {
+      netplay->stale[i][w] |= machine->dirty[w];
+    }
+    machine->dirty[w] = netplay->stale[slot][w];
+    netplay->stale[slot][w] = 0;
+  }
+  snapshot_save(&netplay->saves[slot], machine);
+} /* save_frame() */
+
+/*
+ *  Puts the machine back to a slot, copying back the pages written since
+ *  that save. Those now differ from the machine for every other slot too.
+ */
+
+static void load_frame(netplay_t *netplay, uint32_t slot) {
+  ch8_t *machine = netplay->machine;
+
+  for (int w = 0; w < RAM_PAGES / 64; w++) {
+    uint64_t changed = machine->dirty[w] | netplay->stale[slot][w];
+    for (int i = 0; i < SAVE_COUNT; i++) {
+      netplay->stale[i][w] |= changed;
+    }
+    machine->dirty[w] = changed;
+    netplay->stale[slot][w] = 0;
+  }
+  snapshot_restore(&netplay->saves[slot], machine);
+} /* load_frame() */
+
+/*
+ *  Sends every local input the peer hasn't acknowledged, along with how
+ *  many of its inputs have arrived here.
+ */
+
+static void send_inputs(netplay_t *netplay, uint32_t now) {
+  unsigned char packet[NETPLAY_MAX_PACKET];
+  uint32_t first = netplay->acked;
+
+  if (netplay->frame - first > NETPLAY_HISTORY) {
+    first = netplay->frame - NETPLAY_HISTORY;
+  }
+  uint16_t count = netplay->frame - first;
+
+  put_u32(packet, NETPLAY_MAGIC);
+  put_u32(packet + 4, netplay->session);
+  put_u32(packet + 8, first);
+  put_u32(packet + 12, netplay->remote_count);
+  put_u16(packet + 16, count);
+  for (uint16_t i = 0; i < count; i++) {
+    put_u16(packet + 18 + 2 * i,
+            netplay->local_inputs[(first + i) % NETPLAY_HISTORY]);
+  }
+
+  send_packet(netplay, packet, 18 + 2 * count, now);
+} /* send_inputs() */
+
+/*
+ *  Sends a packet, or queues it until it's due when simulating latency.
+ *  Simulated losses are dropped here.
+ */
+
+static void send_packet(netplay_t *netplay, const unsigned char *data,
+                        size_t size, uint32_t now) {
+  if (netplay->loss > 0) {
+    netplay->rng ^= netplay->rng << 13;
+    netplay->rng ^= netplay->rng >> 17;
+    netplay->rng ^= netplay->rng << 5;
+    if ((int) (netplay->rng % 100) < netplay->loss) {
+      return;
+    }
+  }
+
+  if (netplay->latency == 0) {
+    sendto(netplay->socket, data, size, 0,
+           (struct sockaddr *) &netplay->remote, sizeof(netplay->remote));
+    return;
+  }
+
+  if (netplay->delayed_count < NETPLAY_DELAY_QUEUE) {
+    netplay_delayed_t *delayed = &netplay->delayed[netplay->delayed_count++];
+    delayed->due = now + netplay->latency;
+    delayed->size = size;
+    memcpy(delayed->data, data, size);
+  }
+} /* send_packet() */
+
+/*
+ *  Sends the delayed packets that are due, in the order they were queued.
+ */
+
+static void flush_delayed(netplay_t *netplay, uint32_t now) {
+  int sent = 0;
+
+  while ((sent < netplay->delayed_count) &&
+         ((int32_t) (now - netplay->delayed[sent].due) >= 0)) {
+    sendto(netplay->socket, netplay->delayed[sent].data,
+           netplay->delayed[sent].size, 0,
+           (struct sockaddr *) &netplay->remote, sizeof(netplay->remote));
+    sent++;
+  }
+
+  memmove(netplay->delayed, netplay->delayed + sent,
+          (netplay->delayed_count - sent) * sizeof(netplay_delayed_t));
+  netplay->delayed_count -= sent;
+} /* flush_delayed() */
+
+/*
+ *  Reads every waiting packet, taking in remote inputs that continue the
+ *  ones already received. Returns the first frame that ran with a wrong
+ *  prediction, or UINT32_MAX if none did.
+ */
+
+static uint32_t receive_inputs(netplay_t *netplay) {
+  unsigned char packet[NETPLAY_MAX_PACKET];
+  uint32_t first_wrong = UINT32_MAX;
+  ssize_t size;
+
+  while ((size = recv(netplay->socket, packet, sizeof(packet), 0)) >= 18) {
+    if (get_u32(packet) != NETPLAY_MAGIC) {
+      continue;
+    }
+    if (get_u32(packet + 4) != netplay->session) {
+      netplay->mismatch = true;
+      continue;
+    }
+
+    uint32_t first = get_u32(packet + 8);
+    uint32_t ack = get_u32(packet + 12);
+    uint16_t count = get_u16(packet + 16);
+    if ((count > NETPLAY_HISTORY) || (size < 18 + 2 * count)) {
+      continue;
+    }
+
+    // Packets can arrive out of order, so acknowledgements only go up.
+    if (ack > netplay->acked) {
+      netplay->acked = ack;
+    }
+
+    for (uint32_t f = first; f < first + count; f++) {
+      if (f != netplay->remote_count) {
+        continue; // Already have it, or there's a gap before it
+      }
+
+      uint16_t input = get_u16(packet + 18 + 2 * (f - first));
+      netplay->remote_inputs[f % NETPLAY_HISTORY] = input;
+      netplay->remote_count++;
+      if ((f < netplay->frame) && (f < first_wrong) &&
+          (netplay->predicted[f % NETPLAY_HISTORY] != input)) {
+        first_wrong = f;
+      }
+    }
+  }
+
+  return first_wrong;
+} /* receive_inputs() */
+
+static void put_u16(unsigned char *buf, uint16_t value) {
+  buf[0] = value;
+  buf[1] = value >> 8;
+}
+
+static void put_u32(unsigned char *buf, uint32_t value) {
+  put_u16(buf, value);
+  put_u16(buf + 2, value >> 16);
+}
+
+static uint16_t get_u16(const unsigned char *buf) {
+  return buf[0] | buf[1] << 8;
+}
+
+static uint32_t get_u32(const unsigned char *buf) {
+  return get_u16(buf) | (uint32_t) get_u16(buf + 2) << 16;
+}
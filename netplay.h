@@ -0,0 +1,75 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include "chip8.h"
+#include "clone.h"
+
+#include <netinet/in.h>
+
+#define NETPLAY_MAGIC (0x504E3843) // "C8NP"
+#define NETPLAY_WINDOW (15) // Frames the local side may run past the peer
+#define NETPLAY_HISTORY (64) // Inputs kept for each side, a power of two
+#define NETPLAY_DELAY_QUEUE (256) // Packets held back to simulate latency
+#define NETPLAY_MAX_PACKET (18 + 2 * NETPLAY_HISTORY)
+
+/*
+ *  Two player rollback netplay. Both peers run the same rom with the same
+ *  seed, and the only thing sent is each frame's keypad mask over UDP. The
+ *  machine's keys are the OR of both peers' masks, so each player uses
+ *  their own keys (1/4 and C/D in Pong).
+ *
+ *  Frames run as soon as the local input is known, predicting that the
+ *  remote input hasn't changed. When the real remote input arrives and
+ *  differs, the machine is restored to the start of the first mispredicted
+ *  frame and re-simulated up to the present in one burst. Each packet
+ *  carries every local input the peer hasn't acknowledged yet, so lost
+ *  packets are covered by the next one. The local side stalls if it gets
+ *  NETPLAY_WINDOW frames ahead of the last remote input.
+ *
+ *  Time is passed in by the caller in milliseconds, which is also the clock
+ *  for the simulated latency and loss, so a test can run both peers in one
+ *  process on localhost with a simulated clock.
+ */
+
+typedef struct netplay_delayed {
+  uint32_t due;
+  size_t size;
+  unsigned char data[NETPLAY_MAX_PACKET];
+} netplay_delayed_t;
+
+typedef struct netplay {
+  ch8_t *machine;
+  int socket;
+  struct sockaddr_in remote;
+  uint32_t session; // Hash of the starting machine, the peer's must match
+
+  uint32_t frame; // Frames run so far
+  uint32_t remote_count; // Remote inputs received, for every frame before
+  uint32_t acked; // Local inputs the peer has received
+  uint16_t local_inputs[NETPLAY_HISTORY];
+  uint16_t remote_inputs[NETPLAY_HISTORY];
+  uint16_t predicted[NETPLAY_HISTORY]; // Remote input each frame ran with
+  ch8_snapshot_t saves[NETPLAY_WINDOW + 1]; // Start of each unconfirmed frame
+  uint64_t stale[NETPLAY_WINDOW + 1][RAM_PAGES / 64]; // Pages changed since
+                                                      // each save
+
+  // Simulated network conditions, applied to outgoing packets
+  int latency; // Milliseconds
+  int loss; // Percent
+  uint32_t rng;
+  netplay_delayed_t delayed[NETPLAY_DELAY_QUEUE];
+  int delayed_count;
+
+  unsigned long rollbacks;
+  unsigned long resimulated; // Frames run again after rollbacks
+  unsigned long stalls; // Calls that couldn't run a frame
+  bool mismatch; // The peer runs a different rom or seed
+} netplay_t;
+
+bool netplay_open(netplay_t *, ch8_t *, uint16_t, const char *, uint16_t);
+void netplay_simulate(netplay_t *, int, int, uint32_t);
+void netplay_poll(netplay_t *, uint32_t, bool *);
+bool netplay_advance(netplay_t *, uint16_t, uint32_t, bool *);
+void netplay_close(netplay_t *);
+
+#endif
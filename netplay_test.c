@@ -0,0 +1,156 @@
+#include "chip8.h"
+#include "netplay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *  Loopback test for rollback netplay. Two peers run in this process on
+ *  127.0.0.1 under a simulated clock, each pressing its own random keys,
+ *  over a range of simulated latency and loss. Both machines must end in
+ *  exactly the state of a plain run with the OR of both peers' keys.
+ *
+ *  Usage: chip8-netplay-test [rom]
+ */
+
+#define FRAMES (600)
+#define TICK (16) // Milliseconds per simulated frame
+#define BASE_PORT (47800)
+
+typedef struct conditions {
+  int latency;
+  int loss;
+} conditions_t;
+
+static uint16_t random_keys(uint32_t *);
+static bool same_machine(const ch8_t *, const ch8_t *);
+
+int main(int argc, char *argv[]) {
+  static const conditions_t conditions[] = {
+    { 0, 0 }, { 50, 0 }, { 100, 10 }, { 150, 25 }, { 300, 10 }
+  };
+  const char *rom = (argc > 1) ? argv[1] : "pong.rom";
+  int failed = 0;
+
+  ch8_t *reference = alloc_machines(1);
+  ch8_t *machines[2] = { alloc_machines(1), alloc_machines(1) };
+  netplay_t *peers[2] = { aligned_alloc(CACHE_LINE, sizeof(netplay_t)),
+                          aligned_alloc(CACHE_LINE, sizeof(netplay_t)) };
+  uint16_t inputs[2][FRAMES];
+
+  for (size_t c = 0; c < sizeof(conditions) / sizeof(conditions[0]); c++) {
+    uint16_t port = BASE_PORT + 2 * c;
+
+    for (int p = 0; p < 2; p++) {
+      uint32_t rng = 0x9E3779B9 * (p + 1) + c;
+      uint16_t keys = 0;
+      for (int f = 0; f < FRAMES; f++) {
+        if (f % 20 == 0) {
+          keys = random_keys(&rng);
+        }
+        inputs[p][f] = keys;
+      }
+
+      initialize(machines[p], DEFAULT_SEED);
+      if (!load_rom(machines[p], rom)) {
+        fprintf(stderr, "Can't load %s\n", rom);
+        return 1;
+      }
+      if (!netplay_open(peers[p], machines[p], port + p, "127.0.0.1",
+                        port + 1 - p)) {
+        fprintf(stderr, "Can't open port %d\n", port + p);
+        return 1;
+      }
+      netplay_simulate(peers[p], conditions[c].latency, conditions[c].loss,
+                       0x1234 + p);
+    }
+
+    // Peers take turns under one clock, each one polling until it runs a
+    // frame so a stall costs time but not inputs.
+    uint32_t now = 0;
+    bool draw_flag = false;
+    while ((peers[0]->remote_count < FRAMES) ||
+           (peers[1]->remote_count < FRAMES)) {
+      for (int p = 0; p < 2; p++) {
+        netplay_t *np = peers[p];
+        if (np->frame < FRAMES) {
+          netplay_advance(np, inputs[p][np->frame], now, &draw_flag);
+        } else {
+          netplay_poll(np, now, &draw_flag);
+        }
+      }
+      now += TICK;
+    }
+    // Let the last inputs settle any rollback still owed
+    for (int p = 0; p < 2; p++) {
+      netplay_poll(peers[p], now, &draw_flag);
+    }
+
+    initialize(reference, DEFAULT_SEED);
+    load_rom(reference, rom);
+    for (int f = 0; f < FRAMES; f++) {
+      set_keys(reference, inputs[0][f] | inputs[1][f]);
+      run_frame(reference, &draw_flag);
+    }
+
+    bool ok = true;
+    for (int p = 0; p < 2; p++) {
+      ok = ok && !peers[p]->mismatch && same_machine(machines[p], reference);
+    }
+    printf("%-4s %3dms %2d%% loss: %lu/%lu rollbacks, %lu/%lu frames "
+           "resimulated, %lu/%lu stalls\n", ok ? "PASS" : "FAIL",
+           conditions[c].latency, conditions[c].loss,
+           peers[0]->rollbacks, peers[1]->rollbacks,
+           peers[0]->resimulated, peers[1]->resimulated,
+           peers[0]->stalls, peers[1]->stalls);
+    failed += !ok;
+
+    for (int p = 0; p < 2; p++) {
+      netplay_close(peers[p]);
+    }
+  }
+
+  free(reference);
+  for (int p = 0; p < 2; p++) {
+    free(machines[p]);
+    free(peers[p]);
+  }
+  return failed ? 1 : 0;
+} /* main() */
+
+/*
+ *  One or two keys from the sixteen, or none.
+ */
+
+static uint16_t random_keys(uint32_t *rng) {
+  uint16_t keys = 0;
+
+  for (int i = 0; i < 2; i++) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+    if (*rng & 0x10000) {
+      keys |= 1 << (*rng % 16);
+    }
+  }
+  return keys;
+} /* random_keys() */
+
+/*
+ *  Compares machine state and memory. Dirty page bits only track what
+ *  changed since a snapshot, so they're left out.
+ */
+
+static bool same_machine(const ch8_t *a, const ch8_t *b) {
+  ch8_t *copy = alloc_machines(2);
+
+  memcpy(&copy[0], a, sizeof(ch8_t));
+  memcpy(&copy[1], b, sizeof(ch8_t));
+  memset(copy[0].dirty, 0, sizeof(copy[0].dirty));
+  memset(copy[1].dirty, 0, sizeof(copy[1].dirty));
+  bool same = memcmp(&copy[0], &copy[1], sizeof(ch8_t)) == 0;
+
+  free(copy);
+  return same;
+} /* same_machine() */
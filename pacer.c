@@ -0,0 +1,118 @@
+#include "pacer.h"
+
+#include <stdio.h>
+
+static void pacer_record(frame_pacer_t *, Uint64);
+
+/*
+ *  Sets up a pacer targeting exactly FRAME_RATE frames a second.
+ */
+
+void pacer_init(frame_pacer_t *pacer, bool vsync) {
+  *pacer = (frame_pacer_t) {0};
+
+  pacer->freq = SDL_GetPerformanceFrequency();
+  pacer->period = pacer->freq / FRAME_RATE;
+  pacer->remainder = pacer->freq % FRAME_RATE;
+  pacer->vsync = vsync;
+  pacer->frame_start = SDL_GetPerformanceCounter();
+  pacer->deadline = pacer->frame_start;
+  pacer->stats_start = pacer->frame_start;
+  pacer->min = (Uint64) -1;
+} /* pacer_init() */
+
+/*
+ *  Blocks until the start of the next frame and records how long the last one
+ *  took. Deadlines advance by whole periods with the leftover ticks carried
+ *  over, so time spent emulating and drawing doesn't make the rate drift.
+ */
+
+void pacer_wait(frame_pacer_t *pacer) {
+  pacer->deadline += pacer->period;
+  pacer->error += pacer->remainder;
+  if (pacer->error >= FRAME_RATE) {
+    pacer->deadline++;
+    pacer->error -= FRAME_RATE;
+  }
+
+  Uint64 now = SDL_GetPerformanceCounter();
+
+  if (pacer->vsync) {
+    // The present already waited for the display, just follow it.
+    pacer->deadline = now;
+  } else if (now > pacer->deadline + MAX_LAG_FRAMES * pacer->period) {
+    pacer->deadline = now;
+  } else {
+    Uint64 spin = pacer->freq * SPIN_THRESHOLD_US / 1000000;
+    if (now + spin < pacer->deadline) {
+      SDL_Delay((Uint32) ((pacer->deadline - now - spin) * 1000 /
+                          pacer->freq));
+    }
+
+    while ((now = SDL_GetPerformanceCounter()) < pacer->deadline) {
+      // Spin for the last stretch
+    }
+  }
+
+  pacer_record(pacer, now);
+} /* pacer_wait() */
+
+/*
+ *  Ends a frame without waiting, as in turbo mode, restarting the schedule
+ *  from now so returning to normal speed doesn't run a burst of frames.
+ */
+
+void pacer_resync(frame_pacer_t *pacer) {
+  Uint64 now = SDL_GetPerformanceCounter();
+
+  pacer->deadline = now;
+  pacer->error = 0;
+  pacer_record(pacer, now);
+} /* pacer_resync() */
+
+/*
+ *  Adds the frame ending at now to the statistics.
+ */
+
+static void pacer_record(frame_pacer_t *pacer, Uint64 now) {
+  Uint64 elapsed = now - pacer->frame_start;
+  pacer->frame_start = now;
+  pacer->frames++;
+  pacer->total += elapsed;
+  if (elapsed < pacer->min) {
+    pacer->min = elapsed;
+  }
+  if (elapsed > pacer->max) {
+    pacer->max = elapsed;
+  }
+} /* pacer_record() */
+
+/*
+ *  Once a second, formats the frame rate and frame time statistics into buf,
+ *  resets them and returns true.
+ */
+
+bool pacer_report(frame_pacer_t *pacer, char *buf, size_t size) {
+  if ((pacer->frame_start - pacer->stats_start < pacer->freq) ||
+      (pacer->frames == 0)) {
+    return false;
+  }
+
+  double ms = 1000.0 / pacer->freq;
+  double seconds = (double) (pacer->frame_start - pacer->stats_start) /
+                   pacer->freq;
+  snprintf(buf, size,
+           "%.2f fps, %.1fx speed, frame %.3f ms (min %.3f, max %.3f)",
+           pacer->frames / seconds,
+           pacer->emulated / (seconds * FRAME_RATE),
+           pacer->total * ms / pacer->frames, pacer->min * ms,
+           pacer->max * ms);
+
+  pacer->stats_start = pacer->frame_start;
+  pacer->frames = 0;
+  pacer->emulated = 0;
+  pacer->total = 0;
+  pacer->min = (Uint64) -1;
+  pacer->max = 0;
+  return true;
+} /* pacer_report() */
@@ -0,0 +1,41 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include "include/SDL2/SDL.h"
+
+#include <stdbool.h>
+
+#define FRAME_RATE (60)
+
+// Sleep until this many microseconds before the deadline, then spin, since
+// SDL_Delay() can overshoot by a scheduler quantum.
+#define SPIN_THRESHOLD_US (2000)
+
+// If the loop falls further behind than this many frames, drop them instead
+// of running a burst of frames to catch up.
+#define MAX_LAG_FRAMES (4)
+
+typedef struct frame_pacer {
+  Uint64 freq; // Performance counter ticks per second
+  Uint64 period; // Whole ticks per frame
+  Uint64 remainder; // freq % FRAME_RATE, accumulated into error
+  Uint64 error; // Fractional ticks owed, in 1/FRAME_RATE tick units
+  Uint64 deadline; // Counter value the next frame starts at
+  Uint64 frame_start;
+  bool vsync; // Presentation blocks on vsync, so don't sleep ourselves
+
+  // Frame time statistics, reset every second
+  Uint64 stats_start;
+  unsigned int frames;
+  unsigned int emulated; // Emulated frames, more than frames in turbo mode
+  Uint64 total;
+  Uint64 min;
+  Uint64 max;
+} frame_pacer_t;
+
+void pacer_init(frame_pacer_t *, bool);
+void pacer_wait(frame_pacer_t *);
+void pacer_resync(frame_pacer_t *);
+bool pacer_report(frame_pacer_t *, char *, size_t);
+
+#endif
@@ -0,0 +1,167 @@
+#include "scan.h"
+#include "disasm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void check_instruction(rom_scan_t *, unsigned short, unsigned short);
+static unsigned short fetch(const ch8_t *, unsigned short);
+
+/*
+ *  Loads a rom like load_rom(), then scans it. Returns false, with the
+ *  reasons in the report, if the rom can't be read, doesn't fit in memory
+ *  or reaches an unknown opcode. A rom too big to fit isn't loaded at all.
+ */
+
+bool load_rom_checked(ch8_t *ch8, const char *rom_name, rom_scan_t *scan) {
+  memset(scan, 0, sizeof(*scan));
+
+  FILE *rom = fopen(rom_name, "rb");
+  if (!rom) {
+    return false;
+  }
+  fseek(rom, 0, SEEK_END);
+  long size = ftell(rom);
+  fclose(rom);
+
+  scan->size = (size < 0) ? 0 : size;
+  scan->too_big = scan->size > ROM_MAX_SIZE;
+  if (scan->too_big || !load_rom(ch8, rom_name)) {
+    return false;
+  }
+
+  scan_rom(ch8, scan);
+  return scan->unknown_count == 0;
+} /* load_rom_checked() */
+
+/*
+ *  Scans the code reachable from 0x200 in a machine's memory, filling in
+ *  everything in the report but the size.
+ */
+
+void scan_rom(const ch8_t *ch8, rom_scan_t *scan) {
+  unsigned char *flags = calloc(RAM_SIZE, 1);
+
+  scan->reachable = 0;
+  scan->unknown_count = 0;
+  scan->platform = PLATFORM_CHIP8;
+  scan->quirks = 0;
+
+  if (!flags || !reach(ch8->memory, RAM_SIZE, ROM_START, flags)) {
+    free(flags);
+    return;
+  }
+
+  for (unsigned addr = ROM_START; addr < RAM_SIZE; addr++) {
+    if (!(flags[addr] & REACH_CODE)) {
+      continue;
+    }
+    scan->reachable++;
+
+    unsigned short opcode = fetch(ch8, addr);
+    const opcode_format_t *format = decode(opcode);
+    if (!format) {
+      if (scan->unknown_count < SCAN_MAX_UNKNOWN) {
+        scan->unknown[scan->unknown_count].addr = addr;
+        scan->unknown[scan->unknown_count].opcode = opcode;
+      }
+      scan->unknown_count++;
+      continue;
+    }
+    check_instruction(scan, opcode, format->match);
+  }
+
+  free(flags);
+} /* scan_rom() */
+
+/*
+ *  Prints a report, one finding per line.
+ */
+
+void scan_print(const rom_scan_t *scan, FILE *file) {
+  static const char *platforms[] = { "CHIP-8", "SCHIP", "XO-CHIP" };
+  static const char *quirks[] = {
+    "8XY6/8XYE shift VX in place, ignoring VY",
+    "FX55/FX65 leave I unchanged",
+    "8XY1-8XY3 leave VF unchanged",
+    "BNNN adds V0, not VX as on SCHIP"
+  };
+
+  if (scan->too_big) {
+    fprintf(file, "Rom is %zu bytes, at most %d fit\n", scan->size,
+            ROM_MAX_SIZE);
+    return;
+  }
+
+  fprintf(file, "Rom is %zu bytes, %d instructions reachable, needs %s\n",
+          scan->size, scan->reachable, platforms[scan->platform]);
+  for (int i = 0; (i < scan->unknown_count) && (i < SCAN_MAX_UNKNOWN); i++) {
+    fprintf(file, "Unknown opcode 0x%04X at 0x%03X\n",
+            scan->unknown[i].opcode, scan->unknown[i].addr);
+  }
+  if (scan->unknown_count > SCAN_MAX_UNKNOWN) {
+    fprintf(file, "%d more unknown opcodes\n",
+            scan->unknown_count - SCAN_MAX_UNKNOWN);
+  }
+  for (int i = 0; i < 4; i++) {
+    if (scan->quirks & (1 << i)) {
+      fprintf(file, "Relies on a quirk: %s\n", quirks[i]);
+    }
+  }
+} /* scan_print() */
+
+/*
+ *  Notes the platform an instruction needs and any quirk it depends on,
+ *  given its opcode and the match of its format.
+ */
+
+static void check_instruction(rom_scan_t *scan, unsigned short opcode,
+                              unsigned short match) {
+  int x = (opcode & 0x0F00) >> 8;
+  int y = (opcode & 0x00F0) >> 4;
+  rom_platform_t platform = PLATFORM_CHIP8;
+
+  switch (match) {
+    case 0x00C0: case 0x00FB: case 0x00FC: case 0x00FD: case 0x00FE:
+    case 0x00FF: case 0xF030: case 0xF075: case 0xF085:
+      platform = PLATFORM_SCHIP;
+      break;
+
+    case 0x00D0: case 0x5002: case 0x5003: case 0xF000: case 0xF001:
+    case 0xF002: case 0xF03A:
+      platform = PLATFORM_XOCHIP;
+      break;
+
+    case 0xD000:
+      platform = ((opcode & 0x000F) == 0) ? PLATFORM_SCHIP : PLATFORM_CHIP8;
+      break;
+
+    case 0x8006: case 0x800E:
+      scan->quirks |= (x != y) * QUIRK_SHIFT;
+      break;
+
+    case 0xF055: case 0xF065:
+      scan->quirks |= QUIRK_LOAD_STORE;
+      break;
+
+    case 0x8001: case 0x8002: case 0x8003:
+      scan->quirks |= QUIRK_VF_RESET;
+      break;
+
+    case 0xB000:
+      scan->quirks |= (x != 0) * QUIRK_JUMP;
+      break;
+  }
+
+  if (platform > scan->platform) {
+    scan->platform = platform;
+  }
+} /* check_instruction() */
+
+/*
+ *  Reads the big-endian opcode at an address.
+ */
+
+static unsigned short fetch(const ch8_t *ch8, unsigned short addr) {
+  return ch8->memory[addr] << 8 | ch8->memory[addr + 1];
+} /* fetch() */
@@ -0,0 +1,50 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "chip8.h"
+
+#include <stdio.h>
+
+#define SCAN_MAX_UNKNOWN (8) // Unknown opcodes listed in a report
+
+/*
+ *  Load time checking of a rom. The scan follows every path from 0x200 with
+ *  reach(), the walk chip8-dis uses (jumps, calls, both outcomes of skips,
+ *  and NNN itself for BNNN), and looks at each instruction it reaches, so
+ *  data that happens to decode as garbage isn't held against the rom.
+ *
+ *  It reports unknown opcodes, which extensions the rom needs, and the
+ *  quirk-sensitive instructions it uses: ones whose behavior differs
+ *  between interpreters. This core behaves like SCHIP for all of them
+ *  except BNNN, which adds V0 like the original CHIP-8.
+ */
+
+typedef enum rom_platform {
+  PLATFORM_CHIP8,
+  PLATFORM_SCHIP, // 128x64 mode, scrolling, big font, user flags
+  PLATFORM_XOCHIP // Planes, audio patterns, 16-bit addresses, 5XY2/5XY3
+} rom_platform_t;
+
+#define QUIRK_SHIFT (0x1) // 8XY6/8XYE with X != Y, shifted in place here
+#define QUIRK_LOAD_STORE (0x2) // FX55/FX65, I is left unchanged here
+#define QUIRK_VF_RESET (0x4) // 8XY1-8XY3, VF is left unchanged here
+#define QUIRK_JUMP (0x8) // BNNN with X != 0, adds V0 rather than VX here
+
+typedef struct rom_scan {
+  size_t size; // Bytes in the rom file
+  bool too_big; // More than fits from 0x200 to the end of memory
+  int reachable; // Instructions the scan reached
+  int unknown_count;
+  struct {
+    unsigned short addr;
+    unsigned short opcode;
+  } unknown[SCAN_MAX_UNKNOWN]; // The first few of them
+  rom_platform_t platform;
+  unsigned char quirks; // QUIRK_* bits for the instructions used
+} rom_scan_t;
+
+bool load_rom_checked(ch8_t *, const char *, rom_scan_t *);
+void scan_rom(const ch8_t *, rom_scan_t *);
+void scan_print(const rom_scan_t *, FILE *);
+
+#endif
@@ -0,0 +1,355 @@
+#include "chip8.h"
+#include "disasm.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ *  Conformance runner. Each line of the manifest names a rom, the number of
+ *  frames to run it for and a golden image of the screen it should end on:
+ *
+ *    test_opcode.ch8 120 tests/golden/test_opcode.pgm
+ *
+ *  An optional fourth field, idle or busy, also checks what machine_idle()
+ *  says about the machine at the end.
+ *
+ *  Roms run headless from a fresh machine with the default seed and no keys
+ *  pressed. The screen is compared as a plain PGM, one gray level per plane
+ *  combination, so goldens can be read and diffed as text. On a mismatch
+ *  the actual screen is written next to the golden with .actual appended.
+ *  Missing roms are skipped, so the manifest can list external test suites.
+ *  Tests run in parallel, one thread per core.
+ *
+ *  Before the roms, every opcode is run once to check that the core and the
+ *  format table in disasm.c agree on which ones are unknown, and the timers
+ *  are run across the wrap of the clock.
+ *
+ *  Usage: chip8-test [-u] manifest
+ *    -u  rewrite the golden images from the current results
+ */
+
+#define MAX_TESTS (256)
+#define MAX_PATH (256)
+
+typedef enum result {
+  PASS,
+  FAIL,
+  SKIP,
+  UPDATED
+} result_t;
+
+typedef struct test {
+  char rom[MAX_PATH];
+  int frames;
+  char golden[MAX_PATH];
+  char state[8]; // "idle", "busy", or empty for no check
+  result_t result;
+  int differences; // Pixels that don't match the golden
+  char message[2 * MAX_PATH];
+} test_t;
+
+static test_t tests[MAX_TESTS];
+static int test_count = 0;
+static atomic_int next_test = 0;
+static bool update = false;
+
+static int check_decoder(void);
+static int check_timers(void);
+static void *worker(void *);
+static void run_test(test_t *);
+static void render(const ch8_t *, char *, size_t);
+static char *read_file(const char *);
+static bool write_file(const char *, const char *);
+
+int main(int argc, char *argv[]) {
+  const char *manifest_name = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-u") == 0) {
+      update = true;
+    } else {
+      manifest_name = argv[i];
+    }
+  }
+
+  if (!manifest_name) {
+    fprintf(stderr, "Usage: %s [-u] manifest\n", argv[0]);
+    return 1;
+  }
+
+  int mismatches = check_decoder();
+  if (mismatches) {
+    printf("%-7s decoder: %d opcodes disagree\n", "FAIL", mismatches);
+  } else {
+    printf("%-7s decoder\n", "PASS");
+  }
+
+  int timer_errors = check_timers();
+  printf("%-7s timers%s\n", timer_errors ? "FAIL" : "PASS",
+         timer_errors ? ": wrong value across the clock wrap" : "");
+
+  FILE *manifest = fopen(manifest_name, "r");
+  if (!manifest) {
+    fprintf(stderr, "Can't open %s\n", manifest_name);
+    return 1;
+  }
+
+  char line[3 * MAX_PATH];
+  while (fgets(line, sizeof(line), manifest) && (test_count < MAX_TESTS)) {
+    test_t *test = &tests[test_count];
+    test->state[0] = '\0';
+    if ((line[0] == '#') ||
+        (sscanf(line, "%255s %d %255s %7s", test->rom, &test->frames,
+                test->golden, test->state) < 3)) {
+      continue;
+    }
+    test_count++;
+  }
+  fclose(manifest);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int thread_count = (cores < 1) ? 1 : (cores > test_count) ? test_count :
+                     cores;
+  pthread_t threads[thread_count];
+  for (int i = 0; i < thread_count; i++) {
+    pthread_create(&threads[i], NULL, worker, NULL);
+  }
+  for (int i = 0; i < thread_count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  int failed = 0;
+  for (int i = 0; i < test_count; i++) {
+    static const char *names[] = { "PASS", "FAIL", "SKIP", "UPDATED" };
+    test_t *test = &tests[i];
+    printf("%-7s %s%s%s\n", names[test->result], test->rom,
+           test->message[0] ? ": " : "", test->message);
+    failed += (test->result == FAIL);
+  }
+  failed += (mismatches > 0) + (timer_errors > 0);
+  printf("%d tests, %d failed\n", test_count + 2, failed);
+
+  return failed ? 1 : 0;
+} /* main() */
+
+/*
+ *  Runs every opcode at 0x200 on a fresh machine state and checks that the
+ *  core logs it as unknown exactly when disasm.c can't decode it. Returns
+ *  the number of opcodes they disagree on, printing the first few.
+ */
+
+static int check_decoder(void) {
+  ch8_t *initial = alloc_machines(1);
+  ch8_t *ch8 = alloc_machines(1);
+  log_ring_t *ring = malloc(sizeof(log_ring_t));
+  bool draw_flag = false;
+  int mismatches = 0;
+
+  initialize(initial, DEFAULT_SEED);
+  initial->log = ring;
+  log_init(ring);
+  memcpy(ch8, initial, sizeof(ch8_t));
+
+  for (int opcode = 0; opcode <= 0xFFFF; opcode++) {
+    memcpy(ch8, initial, CH8_STATE_SIZE);
+    ch8->memory[ROM_START] = opcode >> 8;
+    ch8->memory[ROM_START + 1] = opcode & 0xFF;
+
+    unsigned int head = atomic_load(&ring->head);
+    emulate_cycle(ch8, &draw_flag);
+    bool unknown = atomic_load(&ring->head) != head;
+    atomic_store(&ring->tail, atomic_load(&ring->head));
+
+    if (unknown != !decode(opcode)) {
+      if (mismatches++ < 8) {
+        printf("Opcode 0x%04X is %s to the core but %s to disasm.c\n", opcode,
+               unknown ? "unknown" : "known", unknown ? "known" : "unknown");
+      }
+    }
+  }
+
+  free(initial);
+  free(ch8);
+  free(ring);
+  return mismatches;
+} /* check_decoder() */
+
+/*
+ *  Runs timers that have run out for over 2^32 frames, moving the clock
+ *  ahead between stretches of ticks rather than ticking it all the way: a
+ *  timer that ran out must never read as running again once the 32-bit
+ *  clock comes back around to it. Returns the number of wrong reads.
+ */
+
+static int check_timers(void) {
+  static const uint32_t stretches[] = {
+    0xFFFFFF00, // Counts down over the wrap
+    0x7FFFFF00, // Over the midpoint
+    0xFFFFFE00 // Back around to where the timers ran out
+  };
+  ch8_t *ch8 = alloc_machines(1);
+  int errors = 0;
+
+  initialize(ch8, DEFAULT_SEED);
+  ch8->clock = stretches[0];
+  set_delay_timer(ch8, 10);
+  set_sound_timer(ch8, 5);
+
+  for (int s = 0; s < 3; s++) {
+    ch8->clock = stretches[s];
+    for (int i = 0; i < 0x200; i++) {
+      int delay = (s == 0) && (i < 10) ? 10 - i : 0;
+      int sound = (s == 0) && (i < 5) ? 5 - i : 0;
+      errors += (get_delay_timer(ch8) != delay) +
+                (get_sound_timer(ch8) != sound);
+      tick_timers(ch8);
+    }
+  }
+
+  free(ch8);
+  return errors;
+} /* check_timers() */
+
+/*
+ *  Runs tests until there are none left.
+ */
+
+static void *worker(void *arg) {
+  (void) arg;
+
+  for (int i = next_test++; i < test_count; i = next_test++) {
+    run_test(&tests[i]);
+  }
+  return NULL;
+} /* worker() */
+
+/*
+ *  Runs one rom and compares its screen with the golden image.
+ */
+
+static void run_test(test_t *test) {
+  ch8_t *ch8 = alloc_machines(1);
+  bool draw_flag = false;
+
+  initialize(ch8, DEFAULT_SEED);
+  if (!load_rom(ch8, test->rom)) {
+    test->result = SKIP;
+    snprintf(test->message, sizeof(test->message), "rom not found");
+    free(ch8);
+    return;
+  }
+
+  for (int frame = 0; (frame < test->frames) && !ch8->halted; frame++) {
+    run_frame(ch8, &draw_flag);
+  }
+
+  const char *state = machine_idle(ch8) ? "idle" : "busy";
+  if (test->state[0] && (strcmp(test->state, state) != 0)) {
+    test->result = FAIL;
+    snprintf(test->message, sizeof(test->message),
+             "machine is %s, expected %s", state, test->state);
+    free(ch8);
+    return;
+  }
+
+  // Large enough for a hires screen and the header
+  char *actual = malloc(2 * HIRES_WIDTH * HIRES_HEIGHT + 64);
+  render(ch8, actual, 2 * HIRES_WIDTH * HIRES_HEIGHT + 64);
+  free(ch8);
+
+  char *golden = update ? NULL : read_file(test->golden);
+  if (update) {
+    test->result = write_file(test->golden, actual) ? UPDATED : FAIL;
+    snprintf(test->message, sizeof(test->message), "%s", test->golden);
+  } else if (!golden) {
+    test->result = FAIL;
+    snprintf(test->message, sizeof(test->message), "can't read %s",
+             test->golden);
+  } else if (strcmp(golden, actual) == 0) {
+    test->result = PASS;
+  } else {
+    char actual_name[MAX_PATH + 8];
+    size_t len = strlen(golden) < strlen(actual) ? strlen(golden) :
+                 strlen(actual);
+    for (size_t i = 0; i < len; i++) {
+      test->differences += (golden[i] != actual[i]);
+    }
+
+    snprintf(actual_name, sizeof(actual_name), "%s.actual", test->golden);
+    write_file(actual_name, actual);
+    test->result = FAIL;
+    snprintf(test->message, sizeof(test->message),
+             "%d pixels differ, see %s", test->differences, actual_name);
+  }
+
+  free(golden);
+  free(actual);
+} /* run_test() */
+
+/*
+ *  Writes the screen as a plain PGM with one character per pixel, the
+ *  value being the plane bits set there.
+ */
+
+static void render(const ch8_t *ch8, char *buf, size_t size) {
+  int width = ch8->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+  int height = ch8->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+  int words = width / 64;
+  size_t len = snprintf(buf, size, "P2\n%d %d\n%d\n", width, height,
+                        (1 << GFX_PLANES) - 1);
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; (x < width) && (len + 3 < size); x++) {
+      int color = 0;
+      for (int p = 0; p < GFX_PLANES; p++) {
+        color |= ((ch8->gfx[p][y * words + x / 64] >> (63 - x % 64)) & 1)
+                 << p;
+      }
+      buf[len++] = '0' + color;
+      buf[len++] = (x == width - 1) ? '\n' : ' ';
+    }
+  }
+  buf[len] = '\0';
+} /* render() */
+
+/*
+ *  Reads a whole file into a new string, NULL if it can't be read.
+ */
+
+static char *read_file(const char *name) {
+  FILE *file = fopen(name, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+
+  char *text = malloc(size + 1);
+  size_t read = fread(text, 1, size, file);
+  text[read] = '\0';
+  fclose(file);
+
+  return text;
+} /* read_file() */
+
+/*
+ *  Writes a string to a file.
+ */
+
+static bool write_file(const char *name, const char *text) {
+  FILE *file = fopen(name, "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool ok = fwrite(text, 1, strlen(text), file) == strlen(text);
+  fclose(file);
+  return ok;
+} /* write_file() */
@@ -0,0 +1,6 @@
+; Regression rom for chip8-dis: LD I, 0 labels address 0, and the unknown
+; opcode 0000 that follows disassembles to "DW 0x0000", which contains that
+; address. Substituting the label must not look up a format for it.
+
+  LD I, 0
+  DW 0x0000
@@ -0,0 +1,18 @@
+; Code above 0x1000. BNNN reaches 0x10F8 and runs on to 0x1200, where
+; JP 0x200 assembles to 0x1200, the same as the address it sits at. The
+; machine is never idle, and the manifest runs it to a frame that ends
+; with pc at 0x1200.
+
+start:
+  LD I, pattern
+  DRW V5, V5, 8
+  LD V0, 0xF9
+  JP V0, 0xFFF
+pattern:
+  DB 0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF
+
+  ORG 0x10F8
+  REPT 132
+    ADD V3, 1
+  ENDR
+  JP start
@@ -0,0 +1,27 @@
+; High resolution screen for the capture test: a box in each corner, one
+; in the middle, and a row of them drawn on the second plane.
+
+MACRO box x, y
+  LD V0, \x
+  LD V1, \y
+  DRW V0, V1, 8
+ENDM
+
+start:
+  HIGH
+  LD I, pattern
+  box 0, 0
+  box 120, 0
+  box 0, 56
+  box 120, 56
+  box 61, 29
+  PLANE 2
+  REPT 8, n
+    box \n * 15 + 3, \n * 7 + 1
+  ENDR
+  PLANE 1
+end:
+  JP end
+
+pattern:
+  DB 0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF
@@ -0,0 +1,55 @@
+#include "triple.h"
+
+#include <string.h>
+
+/*
+ *  Starts with three blank frames, none of them fresh.
+ */
+
+void triple_init(triple_buffer_t *triple) {
+  memset(triple->frames, 0, sizeof(triple->frames));
+  triple->back = 0;
+  atomic_init(&triple->ready, 1);
+  triple->front = 2;
+} /* triple_init() */
+
+/*
+ *  Writer side: copies the machine's screen into the back frame and makes it
+ *  the ready one, taking the old ready frame as the next back frame.
+ */
+
+void triple_publish(triple_buffer_t *triple, const ch8_t *ch8,
+                    unsigned long number) {
+  frame_copy(&triple->frames[triple->back], ch8, number);
+
+  // Release makes the copy visible before the index is.
+  triple->back = atomic_exchange_explicit(&triple->ready,
+                                          triple->back | TRIPLE_FRESH,
+                                          memory_order_acq_rel) & 0x3;
+} /* triple_publish() */
+
+/*
+ *  Reader side: returns the newest published frame, setting *fresh if it
+ *  wasn't returned before. The frame stays valid until the next call.
+ */
+
+const frame_t *triple_acquire(triple_buffer_t *triple, bool *fresh) {
+  *fresh = atomic_load_explicit(&triple->ready, memory_order_relaxed) &
+           TRIPLE_FRESH;
+
+  if (*fresh) {
+    triple->front = atomic_exchange_explicit(&triple->ready, triple->front,
+                                             memory_order_acq_rel) & 0x3;
+  }
+  return &triple->frames[triple->front];
+} /* triple_acquire() */
+
+/*
+ *  Copies the packed framebuffer and resolution of a machine into a frame.
+ */
+
+void frame_copy(frame_t *frame, const ch8_t *ch8, unsigned long number) {
+  memcpy(frame->gfx, ch8->gfx, sizeof(frame->gfx));
+  frame->hires = ch8->hires;
+  frame->number = number;
+} /* frame_copy() */
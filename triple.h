@@ -0,0 +1,38 @@
+#ifndef TRIPLE_H
+#define TRIPLE_H
+
+#include "chip8.h"
+
+#include <stdatomic.h>
+
+#define TRIPLE_FRESH (0x4) // Set in ready while it holds an unread frame
+
+/*
+ *  Lock-free triple buffer handing finished frames from the emulation thread
+ *  to the render thread. The writer fills its back frame and swaps it with
+ *  the ready one; the reader swaps its front frame with the ready one when
+ *  that's fresh. Neither side ever waits, the reader always gets the newest
+ *  complete frame, and frames it doesn't get to are simply overwritten.
+ */
+
+typedef struct frame {
+  uint64_t gfx[GFX_PLANES][GFX_WORDS];
+  bool hires;
+  unsigned long number; // Emulated frames run when it was published
+} frame_t;
+
+typedef struct triple_buffer {
+  frame_t frames[3];
+
+  // Each index on its own cache line, since each is used by one thread
+  _Alignas(64) atomic_uint ready; // Shared frame, plus TRIPLE_FRESH
+  _Alignas(64) unsigned int back; // Writer's frame
+  _Alignas(64) unsigned int front; // Reader's frame
+} triple_buffer_t;
+
+void triple_init(triple_buffer_t *);
+void triple_publish(triple_buffer_t *, const ch8_t *, unsigned long);
+const frame_t *triple_acquire(triple_buffer_t *, bool *);
+void frame_copy(frame_t *, const ch8_t *, unsigned long);
+
+#endif